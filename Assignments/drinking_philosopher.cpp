@@ -1,5 +1,6 @@
 #include <iostream>
 #include <thread>
+#include <stop_token>
 #include <mutex>
 #include <condition_variable>
 #include <utility>
@@ -7,363 +8,4833 @@
 #include <chrono>
 #include <random>
 #include <memory>
+#include <new>
+#include <cstdlib>
 #include <atomic>
-#include <iomanip>
-#include <sstream>
-#include <map>
 #include <numeric>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <climits>
+#include <string_view>
+#include <span>
+#include <bit>
+#include <optional>
+#include <charconv>
+#include <functional>
+#include <deque>
+#include <queue>
+#include <stdexcept>
+#include <unordered_set>
+#include <fstream>
+#include <sched.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "philosopher_trace.h"
 
 // run the simulation for 15 secs
 #define SIMULATION 15
 
-// Enumeration to represent the state of a philosopher
-enum State { TRANQUIL, THIRSTY, DRINKING };
+/*
+ * Single-producer single-consumer ring. Every logging thread owns one and only ever pushes to it;
+ * the logger thread is the only consumer. A full ring drops the record rather than stalling the producer.
+ */
+class LogRing {
+public:
+    static constexpr size_t CAPACITY = 1024;
 
-// Utility function to convert a State enum to its corresponding string
-std::string stateToString(State state) {
-    switch (state) {
-        case TRANQUIL: return "TRANQUIL";
-        case THIRSTY: return "THIRSTY";
-        case DRINKING: return "DRINKING";
-        default: return "UNKNOWN";
+    bool push(const LogRecord &record) {
+        const size_t tail_now = tail.load(std::memory_order_relaxed);
+        if (tail_now - head_cache == CAPACITY) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (tail_now - head_cache == CAPACITY) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        slots[tail_now % CAPACITY] = record;
+        tail.store(tail_now + 1, std::memory_order_release);
+        return true;
     }
-}
+
+    // Appends every published record to out and frees their slots
+    void drainInto(std::vector<LogRecord> &out) {
+        const size_t head_now = head.load(std::memory_order_relaxed);
+        const size_t tail_now = tail.load(std::memory_order_acquire);
+        for (size_t i = head_now; i != tail_now; ++i) {
+            out.push_back(slots[i % CAPACITY]);
+        }
+        head.store(tail_now, std::memory_order_release);
+    }
+
+    std::atomic<uint64_t> dropped = 0;
+
+private:
+    LogRecord slots[CAPACITY];
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    size_t head_cache = 0; // Producer's last view of head
+};
 
 /**
- * Graph class to represent the topology of philosophers and bottles
- * Implements an adjacency list representation where:
- * - Vertices represent philosophers
- * - Edges represent bottles shared between philosophers
- * - Each edge has a bottleId
+ * Class responsible for logging the state transitions of philosophers and the bottle tables.
+ * Callers only stamp a LogRecord into their thread's LogRing; a background thread drains all rings every few
+ * milliseconds, orders the batch by timestamp, formats it and writes it to stdout with a single call.
+ * The "Bottles: [...]" lines are rebuilt by the logger thread from the claim/free records, so a table never does
+ * any formatting while it holds its bottles.
  */
-class Graph {
+class StateLogger {
 public:
-    Graph(int number_fo_vertices) : adjacency_list(number_fo_vertices) {
+    /**
+      * Logs the current state and action of a philosopher.
+      * @param philosopher_id The ID of the philosopher.
+      * @param state The current state of the philosopher.
+      * @param action The action being performed.
+      * @param bottles Bottle ids the action refers to, if any.
+      */
+    static void log(int philosopher_id, State state, Action action, std::span<const int> bottles = {}) {
+        emit(0, philosopher_id, state, action, bottles);
     }
 
-    // Connect
-    void addEdge(int vectex_1, int vertex_2, int bottle_id) {
-        adjacency_list[vectex_1][vertex_2] = bottle_id;
-        adjacency_list[vertex_2][vectex_1] = bottle_id;
+    // Announces a new Bottles table and returns the id its later records refer to
+    static uint16_t openTable(int number_of_bottles) {
+        const auto table_id = static_cast<uint16_t>(next_table.fetch_add(1, std::memory_order_relaxed));
+        emit(table_id, number_of_bottles, TRANQUIL, TABLE_OPENED, {});
+        return table_id;
     }
 
-    // Get all bottles adjacent to a philosopher
-    std::vector<int> getAdjacentBottles(int philosopher_id) {
-        std::vector<int> bottles;
-        for (const auto &[neighbor, bottle_id]: adjacency_list[philosopher_id]) {
-            bottles.push_back(bottle_id);
-        }
-        return bottles;
+    /**
+      * Logs a change of ownership in a Bottles table.
+      * @param table_id The id returned by openTable.
+      * @param philosopher_id The philosopher claiming or freeing the bottles.
+      * @param action TABLE_CLAIMED or TABLE_FREED.
+      * @param bottles The bottles changing hands.
+      */
+    static void logTable(uint16_t table_id, int philosopher_id, Action action, std::span<const int> bottles) {
+        emit(table_id, philosopher_id, TRANQUIL, action, bottles);
     }
 
-private:
-    std::vector<std::map<int, int> > adjacency_list; // [philosopher][neighbor] = bottle_id
-};
+    // Blocks until everything logged so far, by any thread, has been written out
+    static void flush() {
+        backend().flush();
+    }
 
-// Class to manage bottle resources shared among philosophers
-class Bottles {
-public:
-    // Constructor initializes the bottles, -1 indicates the bottle is free
-    Bottles(const int number_of_bottles) : bottles(number_of_bottles, -1) {
+    /**
+      * Switches from text on stdout to the compact binary trace format described in philosopher_trace.h.
+      * Records are stored with their nanosecond steady_clock timestamps; trace_decoder turns them back into text.
+      * @param path The trace file, created or truncated.
+      */
+    static void traceTo(const std::string &path) {
+        backend().traceTo(path);
     }
 
     /**
-      * Attempts to acquire the specified bottles for a philosopher.
-      * @param philosopher_id The ID of the philosopher attempting to acquire bottles.
-      * @param required_bottles A vector of bottle indices the philosopher requires.
-      * @return True if all bottles are successfully acquired, False otherwise.
+      * While on, records are queued and drained as usual but thrown away instead of written, so the whole logging
+      * path can be exercised without its output. Everything logged before the call is written or thrown away first.
+      * @return The records thrown away since discarding was last turned on.
       */
-    bool acquireBottles(int philosopher_id, const std::vector<int> &required_bottles) {
-        std::unique_lock lock(mtx);
-        // Check if all needed bottles are available
-        for (int bottle: required_bottles) {
-            if (bottles[bottle] != -1 && bottles[bottle] != philosopher_id) {
-                return false;
-            }
-        }
-        // Acquire all needed bottles
-        for (int bottle: required_bottles) {
-            bottles[bottle] = philosopher_id;
-        }
-        logBottleState();
-        return true;
+    static uint64_t setDiscarding(bool on) {
+        return backend().setDiscarding(on);
+    }
+
+    // Turns logging on or off for every thread; records emitted while it is off are discarded, not queued
+    static void setEnabled(bool on) {
+        enabled.store(on, std::memory_order_relaxed);
     }
 
     /**
-      * Releases all bottles held by the specified philosopher.
-      * @param philosopher_id The ID of the philosopher releasing bottles.
+      * Stamps later records with a simulated clock instead of steady_clock, so they read as that much time after
+      * the logger started. Only for single-threaded drivers such as the discrete-event simulation.
+      * @param elapsed_ns Nanoseconds of simulated time, read at every record; nullptr returns to the real clock.
       */
-    void releaseBottles(int philosopher_id) {
-        std::unique_lock lock(mtx);
-        for (int i = 0; i < bottles.size(); ++i) {
-            if (bottles[i] == philosopher_id) {
-                bottles[i] = -1;
+    static void useVirtualClock(const int64_t *elapsed_ns) {
+        virtual_elapsed_ns = elapsed_ns;
+    }
+
+    // The timestamp a record logged right now would carry, in nanoseconds
+    static int64_t now() {
+        return virtual_elapsed_ns
+                   ? backend().steadyStart() + *virtual_elapsed_ns
+                   : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    class Backend {
+    public:
+        Backend() : steady_start(nanosecondsSinceEpoch(std::chrono::steady_clock::now())),
+                    wall_start(nanosecondsSinceEpoch(std::chrono::system_clock::now())),
+                    formatter(steady_start, wall_start),
+                    writer(&Backend::drainLoop, this) {
+        }
+
+        ~Backend() {
+            {
+                std::unique_lock lock(mtx);
+                stopping = true;
             }
+            wake.notify_one();
+            writer.join();
         }
-        logBottleState();
-    }
 
-    // Log the current state of all bottles
-    void logBottleState() {
-        std::stringstream ss;
-        ss << "Bottles: [";
-        for (int i = 0; i < bottles.size(); ++i) {
-            if (i > 0) ss << ", ";
-            if (bottles[i] == -1) {
-                ss << "Free";
-            } else {
-                ss << "P" << bottles[i];
+        LogRing &registerRing() {
+            std::unique_lock lock(mtx);
+            if (!spare_rings.empty()) {
+                LogRing *ring = spare_rings.back();
+                spare_rings.pop_back();
+                return *ring;
+            }
+            return *rings.emplace_back(std::make_unique<LogRing>());
+        }
+
+        // Called as a logging thread exits; its ring keeps being drained and goes to the next new thread
+        void retireRing(LogRing &ring) {
+            std::unique_lock lock(mtx);
+            spare_rings.push_back(&ring);
+        }
+
+        void flush() {
+            std::unique_lock lock(mtx);
+            const uint64_t ticket = ++flush_requested;
+            wake.notify_one();
+            flushed_cv.wait(lock, [&] { return flushed >= ticket; });
+        }
+
+        // Flushes what is pending as text, then makes the logger thread write every later record to path
+        void traceTo(const std::string &path) {
+            flush();
+            std::unique_lock lock(mtx);
+            pending_trace = path;
+        }
+
+        uint64_t setDiscarding(bool on) {
+            flush();
+            std::unique_lock lock(mtx);
+            discarding = on;
+            return std::exchange(discarded, 0);
+        }
+
+        int64_t steadyStart() const {
+            return steady_start;
+        }
+
+    private:
+        static constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(5);
+
+        template<typename Clock>
+        static int64_t nanosecondsSinceEpoch(std::chrono::time_point<Clock> now) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        }
+
+        const int64_t steady_start;
+        const int64_t wall_start;
+        std::mutex mtx; // Guards rings and the flush/stop handshake, never taken by a producer while logging
+        std::condition_variable wake;
+        std::condition_variable flushed_cv;
+        std::vector<std::unique_ptr<LogRing> > rings; // Outlive their threads so late records are never lost
+        std::vector<LogRing *> spare_rings; // Rings of exited threads, so back-to-back runs stop adding new ones
+        uint64_t flush_requested = 0;
+        uint64_t flushed = 0;
+        bool stopping = false;
+        bool discarding = false;
+        uint64_t discarded = 0; // Records drained and thrown away while discarding
+        std::optional<std::string> pending_trace; // Handed from traceTo to the logger thread
+
+        // Owned by the logger thread
+        std::vector<LogRecord> batch;
+        std::string out;
+        TraceFormatter formatter;
+        std::optional<TraceWriter> trace; // Binary trace sink, replaces the text output while open
+        uint64_t reported_drops = 0;
+
+        std::thread writer; // Declared last so it starts after everything it uses
+
+        void drainLoop() {
+            std::unique_lock lock(mtx);
+            while (true) {
+                wake.wait_for(lock, DRAIN_INTERVAL, [&] { return stopping || flush_requested > flushed; });
+                const uint64_t ticket = flush_requested;
+                const bool last = stopping;
+                if (pending_trace) {
+                    trace.emplace(*pending_trace, steady_start, wall_start);
+                    pending_trace.reset();
+                }
+
+                batch.clear();
+                uint64_t drops = 0;
+                for (const auto &ring: rings) {
+                    ring->drainInto(batch);
+                    drops += ring->dropped.load(std::memory_order_relaxed);
+                }
+                const bool discard = discarding;
+                lock.unlock();
+                if (discard) {
+                    reported_drops = drops;
+                } else {
+                    write(drops);
+                }
+                lock.lock();
+                if (discard) {
+                    discarded += batch.size();
+                }
+
+                flushed = ticket;
+                flushed_cv.notify_all();
+                if (last) {
+                    return;
+                }
+            }
+        }
+
+        void write(uint64_t drops) {
+            std::ranges::stable_sort(batch, {}, &LogRecord::timestamp_ns);
+            out.clear();
+            for (const LogRecord &record: batch) {
+                if (trace) {
+                    trace->append(record);
+                } else {
+                    formatter.text(record, out);
+                }
+            }
+            if (drops > reported_drops) {
+                out += "[logger dropped " + std::to_string(drops - reported_drops) + " records]\n";
+                reported_drops = drops;
+            }
+            if (!out.empty()) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
             }
         }
-        ss << "]";
-        std::cout << ss.str() << std::endl;
-        fflush(stdout);
+    };
+
+    static inline std::atomic<int> next_table = 0;
+    static inline std::atomic<bool> enabled = true;
+    static inline const int64_t *virtual_elapsed_ns = nullptr;
+
+    static Backend &backend() {
+        static Backend instance;
+        return instance;
     }
 
-private:
-    std::vector<int> bottles;
-    std::mutex mtx;
+    static LogRing &ring() {
+        struct Lease {
+            LogRing &ring = backend().registerRing();
+
+            ~Lease() {
+                backend().retireRing(ring);
+            }
+        };
+        thread_local Lease mine;
+        return mine.ring;
+    }
+
+    static void emit(uint16_t table_id, int philosopher_id, State state, Action action, std::span<const int> bottles) {
+        if (!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        LogRecord record{};
+        record.timestamp_ns = now();
+        record.philosopher_id = philosopher_id;
+        record.table_id = table_id;
+        record.state = state;
+        record.action = action;
+        size_t offset = 0;
+        do {
+            const size_t count = std::min<size_t>(LogRecord::MAX_BOTTLES, bottles.size() - offset);
+            std::copy_n(bottles.begin() + offset, count, record.bottles);
+            record.bottle_count = static_cast<uint8_t>(count);
+            offset += count;
+            record.flags = offset < bottles.size() ? LogRecord::CONTINUED : 0;
+            ring().push(record);
+        } while (offset < bottles.size());
+    }
 };
 
-// Class responsible for logging the state transitions of philosophers
-class StateLogger {
+/*
+ * Log-linear histogram in the style of HdrHistogram: values below 32 get a bucket each, and every power of two
+ * above that is split into 16 equal buckets, so a recorded value is known to within 1/16 of itself at any scale.
+ * It has a single writer; counts are relaxed atomics so another thread may read a snapshot while it is written.
+ */
+class Histogram {
 public:
-    /**
-      * Logs the current state and action of a philosopher.
-      * @param philosopher_id The ID of the philosopher.
-      * @param state The current state of the philosopher.
-      * @param action A description of the action being performed.
-      */
-    static void log(int philosopher_id, State state, const std::string &action) {
-        std::unique_lock lock(mtx);
-        const auto now = std::chrono::system_clock::now();
-        const auto now_time = std::chrono::system_clock::to_time_t(now);
-        std::cout << std::put_time(std::localtime(&now_time), "%H:%M:%S")
-                << " [P" << philosopher_id << "] "
-                << std::setw(8) << stateToString(state) << " | "
-                << action << std::endl;
+    Histogram() : counts(BUCKETS) {
     }
 
-private:
-    // Mutex to protect logging
-    static std::mutex mtx;
-};
+    void record(uint64_t value) {
+        auto &count = counts[bucketOf(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
 
-// Define static mutex for StateLogger
-std::mutex StateLogger::mtx;
+    // Adds other's counts to this one; this one must not have a concurrent writer
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts[i].store(counts[i].load(std::memory_order_relaxed) + other.counts[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        }
+    }
 
-// Class representing a philosopher in the simulation
-class Philosopher {
-public:
-    /**
-      * Constructor to initialize a philosopher.
-      * @param id The unique ID of the philosopher.
-      * @param bottle A shared pointer to Bottles.
-      * @param graph A shared pointer to Graph
-      */
-    Philosopher(int id, std::shared_ptr<Bottles> bottle, std::shared_ptr<Graph> graph)
-        : id(id), state(TRANQUIL), bottles(std::move(bottle)), graph(std::move(graph)) {
+    void clear() {
+        for (auto &count: counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
     }
 
-    /**
-      * The main loop for the philosopher's behavior.
-      * The philosopher alternates between thinking, becoming thirsty, acquiring bottles, drinking, and releasing bottles.
-      */
-    void run() {
-        while (true) {
-            think();
-            becomeThirsty();
-            while (!requestBottles()) {
-                // Wait for a random short duration before retrying to acquire bottles
-                std::this_thread::sleep_for(std::chrono::milliseconds(rand() % 100));
-            }
-            drink();
-            releaseBottles();
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto &count: counts) {
+            total += count.load(std::memory_order_relaxed);
         }
+        return total;
     }
 
-    State getState() {
-        return state;
+    double mean() const {
+        double sum = 0;
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            const uint64_t count = counts[i].load(std::memory_order_relaxed);
+            sum += static_cast<double>(count) * valueOf(i);
+            total += count;
+        }
+        return total == 0 ? 0 : sum / total;
     }
 
-    void publicBecomeThirsty() {
-        becomeThirsty();
+    // The value at quantile q in [0, 1], as the midpoint of its bucket; 0 when nothing was recorded
+    uint64_t percentile(double q) const {
+        const uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return valueOf(i);
+            }
+        }
+        return valueOf(BUCKETS - 1);
     }
 
 private:
-    int id; // Unique id for the philosopher
-    State state; // Current state of the philosopher
-    std::vector<int> required_bottles;
-    std::shared_ptr<Bottles> bottles;
-    std::shared_ptr<Graph> graph;
-    std::mutex mtx; // Mutex to protect philosopher's state
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr uint64_t LINEAR = 2 << SUB_BUCKET_BITS; // Values below this are stored exactly
+    static constexpr size_t BUCKETS = LINEAR + (64 - SUB_BUCKET_BITS - 1) * (1 << SUB_BUCKET_BITS);
+
+    std::vector<std::atomic<uint64_t> > counts;
 
-    // Simulate thinking
-    void think() {
-        state = TRANQUIL;
-        StateLogger::log(id, state, "Started thinking");
-        std::this_thread::sleep_for(std::chrono::milliseconds(rand() % 1000 + 500));
-        StateLogger::log(id, state, "Finished thinking");
+    static size_t bucketOf(uint64_t value) {
+        if (value < LINEAR) {
+            return value;
+        }
+        const int shift = std::bit_width(value) - 1 - SUB_BUCKET_BITS;
+        return LINEAR + (shift - 1) * (1 << SUB_BUCKET_BITS) + ((value >> shift) - (1 << SUB_BUCKET_BITS));
+    }
+
+    static uint64_t valueOf(size_t bucket) {
+        if (bucket < LINEAR) {
+            return bucket;
+        }
+        const int shift = static_cast<int>((bucket - LINEAR) >> SUB_BUCKET_BITS) + 1;
+        const uint64_t lowest = ((bucket - LINEAR) % (1 << SUB_BUCKET_BITS) + (1 << SUB_BUCKET_BITS)) << shift;
+        return lowest + (uint64_t{1} << shift) / 2;
     }
+};
 
+/*
+ * Acquisition metrics. Every thread that completes an acquisition records it into its own shard, so recording
+ * never contends; shards are merged only when a report is taken. Drink counts live with each Philosopher and
+ * per-bottle contention with each BottleEngine, and are handed to report() by whoever owns them.
+ */
+class Metrics {
+public:
     /**
-     * Transitions the philosopher to the THIRSTY state and determines the bottles needed.
-     */
-    void becomeThirsty() {
-        std::unique_lock lock(mtx);
-        state = THIRSTY;
+      * Records one acquisition by the calling thread.
+      * @param wait_ns Time from becoming thirsty to holding every required bottle.
+      * @param retries Failed attempts at the set before it was handed over.
+      */
+    static void recordAcquisition(int64_t wait_ns, int retries) {
+        Shard &mine = shard();
+        mine.wait_ns.record(static_cast<uint64_t>(std::max<int64_t>(wait_ns, 0)));
+        mine.retries.record(static_cast<uint64_t>(retries));
+    }
 
-        std::random_device rd;
-        std::mt19937 generate(rd());
+    // Forgets everything recorded so far; only while no thread is recording
+    static void reset() {
+        std::unique_lock lock(registry_mtx);
+        for (const auto &mine: shards) {
+            mine->wait_ns.clear();
+            mine->retries.clear();
+        }
+    }
 
-        // Get available bottles from the graph
-        std::vector<int> adjacent_bottles = graph->getAdjacentBottles(id);
+    // What a run's metrics come down to
+    struct Summary {
+        uint64_t acquisitions = 0;
+        uint64_t wait_p50_ns = 0, wait_p99_ns = 0, wait_p999_ns = 0, wait_max_ns = 0; // Thirsty to drinking
+        double retries_mean = 0;
+        uint64_t retries_p99 = 0, retries_max = 0;
+        uint64_t drinks = 0, fewest_drinks = 0, most_drinks = 0;
+        double jain_fairness = 1; // (sum x)^2 / (n sum x^2) over drinks per philosopher, 1 when perfectly even
+        std::vector<std::pair<int, uint64_t> > hottest_bottles; // Up to five (bottle, contention), most contended first
+    };
 
-        // Randomly select 1 or 2 bottles to simulate `philosopher may need different subsets of bottles
-        int limit = (rand() % 2) + 1;
-        required_bottles.clear();
+    /**
+      * Merges every thread's shard with the per-philosopher and per-bottle counts into a summary.
+      * @param drinks Completed drinks per philosopher.
+      * @param contention Failed claims per bottle, from BottleEngine::getContention.
+      */
+    static Summary summarize(std::span<const uint64_t> drinks, std::span<const uint64_t> contention) {
+        Histogram wait_ns;
+        Histogram retries;
+        {
+            std::unique_lock lock(registry_mtx);
+            for (const auto &mine: shards) {
+                wait_ns.merge(mine->wait_ns);
+                retries.merge(mine->retries);
+            }
+        }
 
-        // Random selection of bottles
-        std::vector<int> indices(adjacent_bottles.size());
-        std::iota(indices.begin(), indices.end(), 0);
-        std::ranges::shuffle(indices, generate);
+        Summary summary;
+        summary.acquisitions = wait_ns.count();
+        summary.wait_p50_ns = wait_ns.percentile(0.5);
+        summary.wait_p99_ns = wait_ns.percentile(0.99);
+        summary.wait_p999_ns = wait_ns.percentile(0.999);
+        summary.wait_max_ns = wait_ns.percentile(1);
+        summary.retries_mean = retries.mean();
+        summary.retries_p99 = retries.percentile(0.99);
+        summary.retries_max = retries.percentile(1);
 
-        for (int i = 0; i < limit && i < adjacent_bottles.size(); ++i) {
-            required_bottles.push_back(adjacent_bottles[indices[i]]);
+        const double total = std::accumulate(drinks.begin(), drinks.end(), 0.0);
+        const double squares = std::accumulate(drinks.begin(), drinks.end(), 0.0, [](double sum, uint64_t count) {
+            return sum + static_cast<double>(count) * count;
+        });
+        summary.drinks = static_cast<uint64_t>(total);
+        if (!drinks.empty()) {
+            const auto [fewest, most] = std::ranges::minmax_element(drinks);
+            summary.fewest_drinks = *fewest;
+            summary.most_drinks = *most;
+            summary.jain_fairness = squares == 0 ? 1 : total * total / (drinks.size() * squares);
         }
 
-        std::stringstream ss;
-        ss << "Needs bottles: ";
-        for (size_t i = 0; i < required_bottles.size(); ++i) {
-            if (i > 0) ss << ", ";
-            ss << required_bottles[i];
+        std::vector<int> hottest(contention.size());
+        std::iota(hottest.begin(), hottest.end(), 0);
+        const size_t shown = std::min<size_t>(5, hottest.size());
+        std::ranges::partial_sort(hottest, hottest.begin() + shown, std::greater{},
+                                  [&](int bottle) { return contention[bottle]; });
+        for (size_t i = 0; i < shown && contention[hottest[i]] > 0; ++i) {
+            summary.hottest_bottles.emplace_back(hottest[i], contention[hottest[i]]);
         }
-        StateLogger::log(id, state, ss.str());
+        return summary;
     }
 
-    /**
-     * Attempts to acquire the necessary bottles from the Bottles manager.
-     * @return True if bottles are successfully acquired, False otherwise.
-     */
-    bool requestBottles() {
-        if (bottles->acquireBottles(id, required_bottles)) {
-            state = DRINKING;
-            StateLogger::log(id, state, "Acquired bottles");
-            return true;
+    // Prints wait-time percentiles, retries, drink fairness and the most contended bottles
+    static void report(const Summary &summary) {
+        const auto ms = [](uint64_t ns) { return ns / 1e6; };
+        std::cout << "=== Metrics ===\n"
+                << "Thirsty to drinking (ms): n=" << summary.acquisitions << " p50=" << ms(summary.wait_p50_ns)
+                << " p99=" << ms(summary.wait_p99_ns) << " p999=" << ms(summary.wait_p999_ns)
+                << " max=" << ms(summary.wait_max_ns) << "\n"
+                << "Retries per acquisition: mean=" << summary.retries_mean << " p99=" << summary.retries_p99
+                << " max=" << summary.retries_max << "\n"
+                << "Drinks: total=" << summary.drinks << " min=" << summary.fewest_drinks
+                << " max=" << summary.most_drinks << " Jain fairness=" << summary.jain_fairness << "\n"
+                << "Most contended bottles:";
+        for (const auto &[bottle, count]: summary.hottest_bottles) {
+            std::cout << " " << bottle << " (" << count << ")";
         }
-        return false;
+        std::cout << std::endl;
     }
 
-    // Simulate drinking
-    void drink() {
-        StateLogger::log(id, state, "Started drinking");
-        std::this_thread::sleep_for(std::chrono::milliseconds(rand() % 1000 + 500));
-        StateLogger::log(id, state, "Finished drinking");
-    }
+private:
+    struct Shard {
+        Histogram wait_ns;
+        Histogram retries;
+    };
 
-    void releaseBottles() {
-        bottles->releaseBottles(id);
-        state = TRANQUIL;
-        StateLogger::log(id, state, "Released bottles");
+    static inline std::mutex registry_mtx; // Guards shards, taken as threads start and exit and by summarize()
+    static inline std::vector<std::unique_ptr<Shard> > shards; // Outlive their threads so reports see everything
+    static inline std::vector<Shard *> spare_shards; // Shards of exited threads, reused by the next new ones
+
+    static Shard &shard() {
+        struct Lease {
+            Shard &shard = [] () -> Shard & {
+                std::unique_lock lock(registry_mtx);
+                if (!spare_shards.empty()) {
+                    Shard *spare = spare_shards.back();
+                    spare_shards.pop_back();
+                    return *spare;
+                }
+                return *shards.emplace_back(std::make_unique<Shard>());
+            }();
+
+            ~Lease() {
+                std::unique_lock lock(registry_mtx);
+                spare_shards.push_back(&shard);
+            }
+        };
+        thread_local Lease mine;
+        return mine.shard;
     }
 };
 
-void alphaTests() {
-    std::cout << "\n================ ALPHA TESTS ================\n";
+/**
+ * Graph class to represent the topology of philosophers and bottles
+ * Frozen into a compressed sparse row layout where:
+ * - Vertices represent philosophers
+ * - Edges represent bottles shared between philosophers
+ * - Each edge has a bottleId
+ * Vertex v's edges occupy [offsets[v], offsets[v + 1]) of the contiguous neighbors/bottle_ids arrays, sorted by
+ * neighbor, so lookups never allocate and memory grows linearly with the number of edges. Graphs are put together
+ * with a GraphBuilder.
+ */
+class Graph {
+public:
+    int getNumberOfVertices() const {
+        return static_cast<int>(offsets.size()) - 1;
+    }
 
-    // Test 1: Graph Construction and Edge Addition
-    {
-        Graph g(5);
-        g.addEdge(0, 1, 0);
-        g.addEdge(1, 2, 1);
+    // One more than the highest bottle id on any edge
+    int getNumberOfBottles() const {
+        return number_of_bottles;
+    }
 
-        auto bottles = g.getAdjacentBottles(1);
-        assert(bottles.size() == 2);
-        assert(std::find(bottles.begin(), bottles.end(), 0) != bottles.end());
-        assert(std::find(bottles.begin(), bottles.end(), 1) != bottles.end());
-        std::cout << "Graph construction test passed\n";
+    size_t getNumberOfEdges() const {
+        return neighbors.size() / 2;
     }
 
-    // Test 2: Bottle Management
-    {
-        Bottles bottles(3);
-        std::vector<int> req_bottles = {0, 1};
+    // Get all bottles adjacent to a philosopher, in the order of the neighbors sharing them
+    std::span<const int> getAdjacentBottles(int philosopher_id) const {
+        return {bottle_ids.data() + offsets[philosopher_id], bottle_ids.data() + offsets[philosopher_id + 1]};
+    }
 
-        // Test acquisition
-        assert(bottles.acquireBottles(0, req_bottles) == true);
+    // Get all philosophers sharing a bottle with a philosopher, sorted
+    std::span<const int> getNeighbors(int philosopher_id) const {
+        return {neighbors.data() + offsets[philosopher_id], neighbors.data() + offsets[philosopher_id + 1]};
+    }
 
-        // Test concurrent acquisition
-        std::vector<int> other_bottles = {1, 2};
-        assert(bottles.acquireBottles(1, other_bottles) == false);
+private:
+    friend class GraphBuilder;
 
-        // Test release
-        bottles.releaseBottles(0);
-        assert(bottles.acquireBottles(1, other_bottles) == true);
-        std::cout << "Bottle management test passed\n";
+    std::vector<size_t> offsets; // [philosopher] = start of its row, one extra entry closes the last row
+    std::vector<int> neighbors; // [offsets[p] + i] = i-th neighbor of p
+    std::vector<int> bottle_ids; // [offsets[p] + i] = bottle shared with that neighbor
+    int number_of_bottles = 0;
+};
+
+/**
+ * Collects edges and freezes them into a Graph.
+ * Adding the same pair of philosophers twice keeps the bottle of the later call.
+ */
+class GraphBuilder {
+public:
+    GraphBuilder(int number_fo_vertices) : number_of_vertices(number_fo_vertices) {
+    }
 
+    // Connect; the graph grows to include both vertices
+    void addEdge(int vectex_1, int vertex_2, int bottle_id) {
+        edges.push_back({vectex_1, vertex_2, bottle_id});
+        number_of_vertices = std::max(number_of_vertices, std::max(vectex_1, vertex_2) + 1);
     }
 
-    // Test 3: State Transitions
-    {
-        auto bottles = std::make_shared<Bottles>(3);
-        auto graph = std::make_shared<Graph>(3);
-        Philosopher philosopher(0, bottles, graph);
+    void reserve(size_t number_of_edges) {
+        edges.reserve(number_of_edges);
+    }
 
-        // Test initial state
-        assert(philosopher.getState() == TRANQUIL);
+    // Builds the CSR arrays; the builder is left empty
+    Graph build() {
+        Graph graph;
+        graph.offsets.assign(number_of_vertices + 1, 0);
+        for (const Edge &edge: edges) {
+            ++graph.offsets[edge.vertex_1 + 1];
+            ++graph.offsets[edge.vertex_2 + 1];
+            graph.number_of_bottles = std::max(graph.number_of_bottles, edge.bottle_id + 1);
+        }
+        std::partial_sum(graph.offsets.begin(), graph.offsets.end(), graph.offsets.begin());
 
-        philosopher.publicBecomeThirsty();
-        assert(philosopher.getState() == THIRSTY);
-        std::cout << "Philosopher state transition test passed\n";
+        // Counting sort by vertex keeps insertion order within each row
+        std::vector<std::pair<int, int> > row_entries(graph.offsets.back()); // (neighbor, bottle)
+        std::vector<size_t> fill(graph.offsets.begin(), graph.offsets.end() - 1);
+        for (const Edge &edge: edges) {
+            row_entries[fill[edge.vertex_1]++] = {edge.vertex_2, edge.bottle_id};
+            row_entries[fill[edge.vertex_2]++] = {edge.vertex_1, edge.bottle_id};
+        }
+        std::vector<Edge>().swap(edges);
+
+        graph.neighbors.reserve(row_entries.size());
+        graph.bottle_ids.reserve(row_entries.size());
+        size_t row_start = 0;
+        for (int vertex = 0; vertex < number_of_vertices; ++vertex) {
+            const auto begin = row_entries.begin() + graph.offsets[vertex];
+            const auto end = row_entries.begin() + graph.offsets[vertex + 1];
+            std::stable_sort(begin, end, [](const auto &a, const auto &b) { return a.first < b.first; });
+            for (auto it = begin; it != end; ++it) {
+                if (std::next(it) != end && std::next(it)->first == it->first) {
+                    continue; // A later addEdge for the same neighbor wins
+                }
+                graph.neighbors.push_back(it->first);
+                graph.bottle_ids.push_back(it->second);
+            }
+            graph.offsets[vertex] = row_start;
+            row_start = graph.neighbors.size();
+        }
+        graph.offsets[number_of_vertices] = row_start;
+        graph.neighbors.shrink_to_fit();
+        graph.bottle_ids.shrink_to_fit();
+        return graph;
     }
 
-}
+private:
+    struct Edge {
+        int vertex_1;
+        int vertex_2;
+        int bottle_id;
+    };
 
-int main() {
-    srand(time(0));
-    constexpr int number_of_philosophers = 5;
-    constexpr int number_of_bottles = 6;
+    int number_of_vertices;
+    std::vector<Edge> edges;
+};
 
-    alphaTests();
+// Strategy Bottles uses to arbitrate ownership of its slots
+enum BottlePolicy {
+    GLOBAL_MUTEX, // one mutex serializes every acquire/release on the whole table
+    PER_BOTTLE_CAS, // each slot is an atomic owner claimed by compare-and-swap
+    WORD_MASK // a packed bitset of taken bottles, claimed a 64-bottle word per compare-and-swap
+};
 
-    std::cout << "\n================ BETA TESTS ================\n";
+// Utility function to convert a BottlePolicy enum to its corresponding string
+std::string policyToString(BottlePolicy policy) {
+    switch (policy) {
+        case GLOBAL_MUTEX: return "mutex";
+        case PER_BOTTLE_CAS: return "cas";
+        case WORD_MASK: return "mask";
+        default: return "unknown";
+    }
+}
 
-    // Create and initialize the graph
-    auto graph = std::make_shared<Graph>(number_of_philosophers);
+/**
+ * How Bottles settles which queued philosopher gets bottles that several of them wait for.
+ * Every policy but GREEDY ranks waiters by a key, and a philosopher does not take a bottle, queued or straight
+ * away, while a better-ranked philosopher is queued for it. The best-ranked waiter of all is only ever held up by
+ * bottles in use, so every wait is bounded by the drinks of those ranked ahead of it.
+ */
+struct Arbitration {
+    enum Kind {
+        GREEDY, // whoever finds its whole set free first takes it; fastest, but a big set can starve
+        FIFO, // earliest to queue first, on every bottle
+        AGING, // greedy until a waiter has waited age_limit, then its bottles are held back for it
+        PRECEDENCE // the classic precedence graph: whoever drank least recently first, ties to the lower id
+    };
 
-    graph->addEdge(0, 1, 0);
-    graph->addEdge(1, 2, 1);
-    graph->addEdge(2, 3, 2);
-    graph->addEdge(3, 4, 3);
-    graph->addEdge(4, 0, 4);
-    graph->addEdge(0, 2, 5);
+    Kind kind = GREEDY;
+    std::chrono::milliseconds age_limit{50}; // AGING only
 
-    auto bottles = std::make_shared<Bottles>(number_of_bottles);
-    std::vector<std::thread> threads;
-    std::vector<std::unique_ptr<Philosopher> > philosophers;
+    /**
+      * Parses greedy, fifo, aging:MS or precedence.
+      * @throws std::invalid_argument if the spec is malformed.
+      */
+    static Arbitration parse(std::string_view spec) {
+        Arbitration arbitration;
+        if (spec == "greedy") {
+            arbitration.kind = GREEDY;
+        } else if (spec == "fifo") {
+            arbitration.kind = FIFO;
+        } else if (spec == "precedence") {
+            arbitration.kind = PRECEDENCE;
+        } else if (spec.starts_with("aging:")) {
+            int limit_ms = 0;
+            const auto [end, ec] = std::from_chars(spec.data() + 6, spec.data() + spec.size(), limit_ms);
+            if (ec != std::errc() || end != spec.data() + spec.size() || limit_ms < 0) {
+                throw std::invalid_argument("bad arbitration: " + std::string(spec));
+            }
+            arbitration.kind = AGING;
+            arbitration.age_limit = std::chrono::milliseconds(limit_ms);
+        } else {
+            throw std::invalid_argument("bad arbitration: " + std::string(spec));
+        }
+        return arbitration;
+    }
 
-    std::cout << "=== Simulating Drinking Philosophers for " << SIMULATION << " secs ===" << std::endl;
-    std::cout << "Time\t[Phil]\tState\t|\tAction" << std::endl;
-    std::cout << "-------------------------------------------" << std::endl;
+    std::string toString() const {
+        switch (kind) {
+            case GREEDY: return "greedy";
+            case FIFO: return "fifo";
+            case AGING: return "aging:" + std::to_string(age_limit.count());
+            default: return "precedence";
+        }
+    }
+};
+
+/*
+ * Topology generators and loaders. Bottle ids are handed out in edge order, so a graph with E edges uses bottles
+ * 0..E-1 unless an edge list names its own.
+ */
+namespace topology {
+    // The original demo table: a ring of five plus the chord between P0 and P2
+    inline Graph classic() {
+        GraphBuilder builder(5);
+        builder.addEdge(0, 1, 0);
+        builder.addEdge(1, 2, 1);
+        builder.addEdge(2, 3, 2);
+        builder.addEdge(3, 4, 3);
+        builder.addEdge(4, 0, 4);
+        builder.addEdge(0, 2, 5);
+        return builder.build();
+    }
 
-    // Initialize philosophers
-    philosophers.reserve(number_of_philosophers);
-    for (int idx = 0; idx < number_of_philosophers; ++idx) {
-        philosophers.emplace_back(std::make_unique<Philosopher>(idx, bottles, graph));
+    inline Graph ring(int number_of_vertices) {
+        GraphBuilder builder(number_of_vertices);
+        const int edges = number_of_vertices > 2 ? number_of_vertices : number_of_vertices - 1;
+        builder.reserve(std::max(edges, 0));
+        for (int vertex = 0; vertex < edges; ++vertex) {
+            builder.addEdge(vertex, (vertex + 1) % number_of_vertices, vertex);
+        }
+        return builder.build();
     }
 
-    // Start philosopher threads
-    for (int idx = 0; idx < number_of_philosophers; ++idx) {
-        threads.emplace_back(&Philosopher::run, philosophers[idx].get());
+    // A width x height lattice; a torus also wraps every row and column around
+    inline Graph grid(int width, int height, bool torus) {
+        GraphBuilder builder(width * height);
+        builder.reserve(2 * static_cast<size_t>(width) * height);
+        int bottle = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const int vertex = y * width + x;
+                if (x + 1 < width || (torus && width > 2)) {
+                    builder.addEdge(vertex, y * width + (x + 1) % width, bottle++);
+                }
+                if (y + 1 < height || (torus && height > 2)) {
+                    builder.addEdge(vertex, ((y + 1) % height) * width + x, bottle++);
+                }
+            }
+        }
+        return builder.build();
     }
 
-    // Run simulation for specified duration
-    std::this_thread::sleep_for(std::chrono::seconds(SIMULATION));
+    /**
+     * Random degree-regular graph from the configuration model: every vertex gets `degree` stubs and a shuffle
+     * pairs them up. Self-loops and repeated pairs are repaired by swapping endpoints with random other edges;
+     * the few a bounded number of swaps cannot fix are dropped, so a handful of vertices may end up one short.
+     */
+    inline Graph randomRegular(int number_of_vertices, int degree, uint64_t seed) {
+        std::mt19937_64 generate(seed);
+        std::vector<int> stubs;
+        stubs.reserve(static_cast<size_t>(number_of_vertices) * degree);
+        for (int vertex = 0; vertex < number_of_vertices; ++vertex) {
+            stubs.insert(stubs.end(), degree, vertex);
+        }
+        if (stubs.size() % 2) {
+            stubs.pop_back();
+        }
+        std::ranges::shuffle(stubs, generate);
 
-    // Kill
-    std::quick_exit(0);
+        const auto key = [](int a, int b) {
+            return static_cast<uint64_t>(std::min(a, b)) << 32 | static_cast<uint32_t>(std::max(a, b));
+        };
+        const size_t pairs = stubs.size() / 2;
+        std::unordered_set<uint64_t> seen;
+        seen.reserve(pairs);
+        std::vector<size_t> bad;
+        std::vector<char> is_bad(pairs, false);
+        for (size_t i = 0; i < pairs; ++i) {
+            const int a = stubs[2 * i], b = stubs[2 * i + 1];
+            if (a == b || !seen.insert(key(a, b)).second) {
+                bad.push_back(i);
+                is_bad[i] = true;
+            }
+        }
+
+        std::uniform_int_distribution<size_t> pick(0, pairs ? pairs - 1 : 0);
+        for (size_t attempt = 0; !bad.empty() && attempt < 64 * (bad.size() + 16); ++attempt) {
+            const size_t i = bad.back(), j = pick(generate);
+            int &a = stubs[2 * i + 1], &c = stubs[2 * j + 1];
+            const int b = stubs[2 * i], d = stubs[2 * j];
+            // Swap (b, a), (d, c) into (b, c), (d, a) when that gives two fresh simple edges
+            if (is_bad[j] || b == c || d == a || key(b, c) == key(d, a)
+                || seen.contains(key(b, c)) || seen.contains(key(d, a))) {
+                continue;
+            }
+            seen.erase(key(d, c));
+            std::swap(a, c);
+            seen.insert(key(b, a));
+            seen.insert(key(d, c));
+            is_bad[i] = false;
+            bad.pop_back();
+        }
+
+        GraphBuilder builder(number_of_vertices);
+        builder.reserve(pairs);
+        int bottle = 0;
+        for (size_t i = 0; i < pairs; ++i) {
+            if (!is_bad[i]) {
+                builder.addEdge(stubs[2 * i], stubs[2 * i + 1], bottle++);
+            }
+        }
+        return builder.build();
+    }
+
+    /**
+     * Scale-free graph by Barabasi-Albert preferential attachment: vertices arrive one at a time and link to
+     * `edges_per_vertex` distinct earlier vertices, picked with probability proportional to their degree.
+     */
+    inline Graph powerLaw(int number_of_vertices, int edges_per_vertex, uint64_t seed) {
+        std::mt19937_64 generate(seed);
+        GraphBuilder builder(number_of_vertices);
+        builder.reserve(static_cast<size_t>(number_of_vertices) * edges_per_vertex);
+        std::vector<int> endpoints; // Every edge contributes both ends, so a uniform pick is degree-weighted
+        endpoints.reserve(2 * static_cast<size_t>(number_of_vertices) * edges_per_vertex);
+        std::vector<int> targets;
+        int bottle = 0;
+
+        const int seed_vertices = std::min(number_of_vertices, edges_per_vertex + 1);
+        for (int a = 0; a < seed_vertices; ++a) {
+            for (int b = a + 1; b < seed_vertices; ++b) {
+                builder.addEdge(a, b, bottle++);
+                endpoints.push_back(a);
+                endpoints.push_back(b);
+            }
+        }
+        for (int vertex = seed_vertices; vertex < number_of_vertices; ++vertex) {
+            targets.clear();
+            std::uniform_int_distribution<size_t> pick(0, endpoints.size() - 1);
+            while (static_cast<int>(targets.size()) < edges_per_vertex) {
+                const int target = endpoints[pick(generate)];
+                if (std::ranges::find(targets, target) == targets.end()) {
+                    targets.push_back(target);
+                }
+            }
+            for (int target: targets) {
+                builder.addEdge(vertex, target, bottle++);
+                endpoints.push_back(vertex);
+                endpoints.push_back(target);
+            }
+        }
+        return builder.build();
+    }
+
+    /**
+     * Streams a whitespace separated edge list straight out of a read-only mapping of the file.
+     * Each line is "u v" or "u v bottle"; blank lines and lines starting with '#' or '%' are skipped.
+     * The graph gets one vertex more than the highest id mentioned.
+     * @param path The edge-list file.
+     */
+    inline Graph loadEdgeList(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat info{};
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            throw std::runtime_error("cannot open edge list " + path);
+        }
+        const size_t size = static_cast<size_t>(info.st_size);
+        GraphBuilder builder(0);
+        if (size == 0) {
+            close(fd);
+            return builder.build();
+        }
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("cannot map edge list " + path);
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        // A typical line is around a dozen bytes
+        builder.reserve(size / 12);
+        const char *cursor = static_cast<const char *>(mapped);
+        const char *const end = cursor + size;
+        int next_bottle = 0;
+        size_t line_number = 0;
+        while (cursor < end) {
+            const char *eol = static_cast<const char *>(memchr(cursor, '\n', end - cursor));
+            if (eol == nullptr) eol = end;
+            ++line_number;
+
+            int fields[3];
+            int count = 0;
+            const char *field = cursor;
+            while (count < 3) {
+                while (field < eol && (*field == ' ' || *field == '\t' || *field == '\r' || *field == ',')) ++field;
+                if (field == eol || (count == 0 && (*field == '#' || *field == '%'))) break;
+                const auto [next, error] = std::from_chars(field, eol, fields[count]);
+                if (error != std::errc() || fields[count] < 0) {
+                    munmap(mapped, size);
+                    throw std::runtime_error(path + ":" + std::to_string(line_number) + ": bad edge");
+                }
+                field = next;
+                ++count;
+            }
+            if (count == 1) {
+                munmap(mapped, size);
+                throw std::runtime_error(path + ":" + std::to_string(line_number) + ": edge needs two vertices");
+            }
+            if (count >= 2) {
+                builder.addEdge(fields[0], fields[1], count == 3 ? fields[2] : next_bottle);
+                next_bottle = std::max(next_bottle, count == 3 ? fields[2] : next_bottle) + 1;
+            }
+            cursor = eol + 1;
+        }
+        munmap(mapped, size);
+        return builder.build();
+    }
+
+    /**
+     * Builds the topology named by a command line spec:
+     * classic, ring:N, grid:WxH, torus:WxH, regular:N:D, powerlaw:N:M or file:PATH.
+     * @param spec The spec.
+     * @param seed Seed for the random generators.
+     */
+    inline Graph fromSpec(std::string_view spec, uint64_t seed) {
+        const auto colon = spec.find(':');
+        const std::string_view kind = spec.substr(0, colon);
+        const std::string_view rest = colon == std::string_view::npos ? "" : spec.substr(colon + 1);
+        std::vector<int> numbers;
+        for (const char *cursor = rest.data(), *end = rest.data() + rest.size(); kind != "file" && cursor < end;) {
+            int value = 0;
+            const auto [next, error] = std::from_chars(cursor, end, value);
+            if (error != std::errc() || value <= 0) {
+                throw std::invalid_argument("bad topology " + std::string(spec));
+            }
+            numbers.push_back(value);
+            cursor = next == end ? next : next + 1;
+        }
+        const auto expect = [&](size_t count) {
+            if (numbers.size() != count) throw std::invalid_argument("bad topology " + std::string(spec));
+        };
+
+        if (kind == "classic") {
+            expect(0);
+            return classic();
+        } else if (kind == "ring") {
+            expect(1);
+            return ring(numbers[0]);
+        } else if (kind == "grid" || kind == "torus") {
+            expect(2);
+            return grid(numbers[0], numbers[1], kind == "torus");
+        } else if (kind == "regular") {
+            expect(2);
+            return randomRegular(numbers[0], numbers[1], seed);
+        } else if (kind == "powerlaw") {
+            expect(2);
+            return powerLaw(numbers[0], numbers[1], seed);
+        } else if (kind == "file" && !rest.empty()) {
+            return loadEdgeList(std::string(rest));
+        }
+        throw std::invalid_argument("bad topology " + std::string(spec));
+    }
+}
+
+/*
+ * NUMA-aware placement. The graph is cut into partitions along a breadth-first ordering and renumbered so every
+ * partition's philosophers and bottles have contiguous ids. Each partition is mapped to a NUMA node: the threads
+ * running its philosophers are pinned to that node's CPUs and the pages holding its slice of per-bottle and
+ * per-philosopher state are bound to its memory. A bottle belongs to the partition of the first of its two
+ * philosophers in the ordering, so only bottles on edges between partitions are touched from two nodes.
+ * Uses the mbind system call directly rather than libnuma; where it or the node information is missing, placement
+ * degrades to pinning alone.
+ */
+namespace placement {
+    // From <linux/mempolicy.h>
+    constexpr int MPOL_BIND_POLICY = 2;
+    constexpr unsigned MPOL_MOVE_PAGES = 1 << 1;
+
+    // Parses a kernel CPU or node list such as "0-3,8,10-11"
+    inline std::vector<int> parseList(std::string_view list) {
+        std::vector<int> items;
+        while (!list.empty()) {
+            const size_t comma = std::min(list.find(','), list.size());
+            const std::string_view range = list.substr(0, comma);
+            list.remove_prefix(std::min(comma + 1, list.size()));
+            const size_t dash = range.find('-');
+            int first = 0, last = 0;
+            std::from_chars(range.data(), range.data() + std::min(dash, range.size()), first);
+            last = first;
+            if (dash != std::string_view::npos) {
+                std::from_chars(range.data() + dash + 1, range.data() + range.size(), last);
+            }
+            for (int item = first; item <= last; ++item) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    inline std::string readLine(const std::string &path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    struct Node {
+        int id;
+        std::vector<int> cpus;
+    };
+
+    // The online NUMA nodes that have CPUs we may run on; a single pseudo-node with every allowed CPU without sysfs
+    inline std::vector<Node> onlineNodes() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+
+        std::vector<Node> nodes;
+        for (int id: parseList(readLine("/sys/devices/system/node/online"))) {
+            Node node{id, {}};
+            for (int cpu: parseList(readLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"))) {
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            if (!node.cpus.empty()) {
+                nodes.push_back(std::move(node));
+            }
+        }
+        if (nodes.empty()) {
+            Node node{0, {}};
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            nodes.push_back(std::move(node));
+        }
+        return nodes;
+    }
+
+    // Restricts the calling thread to the given CPUs; best effort
+    inline void pinCurrentThread(std::span<const int> cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    /**
+      * Binds the whole pages inside [begin, begin + bytes) to a node's memory, moving any already touched.
+      * Pages shared with the neighbouring range are left where they are.
+      * @return False if the kernel refused or nothing in the range fills a whole page.
+      */
+    inline bool bindToNode(const void *begin, size_t bytes, int node) {
+#ifdef SYS_mbind
+        static const uintptr_t page = sysconf(_SC_PAGESIZE);
+        const uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page - 1) / page * page;
+        const uintptr_t last = (reinterpret_cast<uintptr_t>(begin) + bytes) / page * page;
+        if (node < 0 || node >= 64 || last <= first) {
+            return false;
+        }
+        const unsigned long mask = 1ul << node;
+        return syscall(SYS_mbind, first, last - first, MPOL_BIND_POLICY, &mask, sizeof(mask) * 8 + 1,
+                       MPOL_MOVE_PAGES) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // Partitions of a renumbered graph and where each of them runs
+    struct Plan {
+        std::vector<int> philosopher_begin; // [partition] = first philosopher, one extra entry closes the last
+        std::vector<int> bottle_begin; // [partition] = first bottle, one extra entry closes the last
+        std::vector<Node> nodes; // [partition] = node it runs on and allocates from
+        size_t cut_edges = 0; // Edges between two partitions
+
+        int getNumberOfPartitions() const {
+            return static_cast<int>(nodes.size());
+        }
+
+        int partitionOf(int philosopher_id) const {
+            return static_cast<int>(std::ranges::upper_bound(philosopher_begin, philosopher_id) -
+                                    philosopher_begin.begin()) - 1;
+        }
+
+        // Binds each partition's slice of an array indexed by philosopher, or by bottle, to its node
+        template<typename T>
+        void bindByPhilosopher(std::span<T> items) const {
+            bindSlices(items, philosopher_begin);
+        }
+
+        template<typename T>
+        void bindByBottle(std::span<T> items) const {
+            bindSlices(items, bottle_begin);
+        }
+
+        template<typename T>
+        void bindSlices(std::span<T> items, std::span<const int> begin) const {
+            if (nodes.size() < 2) {
+                return;
+            }
+            for (size_t part = 0; part + 1 < begin.size(); ++part) {
+                const size_t first = std::min<size_t>(begin[part], items.size());
+                const size_t last = std::min<size_t>(begin[part + 1], items.size());
+                bindToNode(items.data() + first, (last - first) * sizeof(T), nodes[part].id);
+            }
+        }
+    };
+
+    /**
+     * Orders the philosophers breadth first, starting again from the lowest unvisited one in every component, cuts
+     * the order into number_of_partitions runs of equal length and renumbers graph to match. Bottles are renumbered
+     * in the order their first philosopher reaches them.
+     * @param graph The graph to renumber; replaced by the renumbered one.
+     * @param number_of_partitions How many partitions to cut, at least one; partition k runs on node k % nodes.
+     * @param nodes The nodes to spread the partitions over.
+     */
+    inline Plan partition(Graph &graph, int number_of_partitions, const std::vector<Node> &nodes) {
+        const int number_of_philosophers = graph.getNumberOfVertices();
+        number_of_partitions = std::clamp(number_of_partitions, 1, std::max(number_of_philosophers, 1));
+        std::vector<int> order;
+        order.reserve(number_of_philosophers);
+        std::vector<int> renumbered(number_of_philosophers, -1);
+        for (int root = 0; root < number_of_philosophers; ++root) {
+            if (renumbered[root] >= 0) {
+                continue;
+            }
+            renumbered[root] = static_cast<int>(order.size());
+            order.push_back(root);
+            for (size_t head = order.size() - 1; head < order.size(); ++head) {
+                for (int neighbor: graph.getNeighbors(order[head])) {
+                    if (renumbered[neighbor] < 0) {
+                        renumbered[neighbor] = static_cast<int>(order.size());
+                        order.push_back(neighbor);
+                    }
+                }
+            }
+        }
+
+        Plan plan;
+        for (int part = 0; part <= number_of_partitions; ++part) {
+            plan.philosopher_begin.push_back(
+                static_cast<int>(static_cast<int64_t>(number_of_philosophers) * part / number_of_partitions));
+        }
+        for (int part = 0; part < number_of_partitions; ++part) {
+            plan.nodes.push_back(nodes[part % nodes.size()]);
+        }
+
+        GraphBuilder builder(number_of_philosophers);
+        builder.reserve(graph.getNumberOfEdges());
+        std::vector<int> bottle_of(graph.getNumberOfBottles(), -1);
+        int next_bottle = 0;
+        for (int part = 0; part < number_of_partitions; ++part) {
+            plan.bottle_begin.push_back(next_bottle);
+            for (int philosopher = plan.philosopher_begin[part]; philosopher < plan.philosopher_begin[part + 1];
+                 ++philosopher) {
+                const int old_id = order[philosopher];
+                const auto neighbors = graph.getNeighbors(old_id);
+                const auto adjacent_bottles = graph.getAdjacentBottles(old_id);
+                for (size_t i = 0; i < neighbors.size(); ++i) {
+                    const int neighbor = renumbered[neighbors[i]];
+                    if (neighbor < philosopher) {
+                        continue; // Added from the neighbor's row
+                    }
+                    if (bottle_of[adjacent_bottles[i]] < 0) {
+                        bottle_of[adjacent_bottles[i]] = next_bottle++;
+                    }
+                    builder.addEdge(philosopher, neighbor, bottle_of[adjacent_bottles[i]]);
+                    if (neighbor >= plan.philosopher_begin[part + 1]) {
+                        ++plan.cut_edges;
+                    }
+                }
+            }
+        }
+        plan.bottle_begin.push_back(next_bottle);
+        graph = builder.build();
+        return plan;
+    }
+}
+
+/**
+ * Interface a Philosopher uses to get hold of its bottles, whichever engine arbitrates them.
+ * Engines may need the philosopher's own thread to keep answering its neighbours while it thinks or drinks,
+ * which is why the philosopher waits out those periods through idle rather than sleeping directly.
+ */
+class BottleEngine {
+public:
+    virtual ~BottleEngine() = default;
+
+    /**
+      * Blocks until the philosopher holds every bottle in required_bottles, or until stop is requested.
+      * @return How many attempts failed first, or nullopt if it was stopped before getting them all. It may then
+      *         hold some of them, and gives them back through releaseBottles as after a drink.
+      */
+    virtual std::optional<int> acquireBottlesBlocking(int philosopher_id, const std::vector<int> &required_bottles,
+                                                      std::stop_token stop = {}) = 0;
+
+    // Gives back every bottle the philosopher holds for its current drink
+    virtual void releaseBottles(int philosopher_id) = 0;
+
+    // Same, for callers that know which bottles the philosopher holds; engines may then skip looking for them
+    virtual void releaseBottles(int philosopher_id, std::span<const int> /*held*/) {
+        releaseBottles(philosopher_id);
+    }
+
+    // Passes the given amount of time on behalf of the philosopher, or less if stop is requested meanwhile
+    virtual void idle(int /*philosopher_id*/, std::chrono::milliseconds duration, std::stop_token stop = {}) {
+        if (!stop.stop_possible()) {
+            std::this_thread::sleep_for(duration);
+            return;
+        }
+        // Kept per thread: nobody else waits on them, and a condition_variable_any allocates when constructed
+        thread_local std::mutex mtx;
+        thread_local std::condition_variable_any interrupted;
+        std::unique_lock lock(mtx);
+        interrupted.wait_for(lock, stop, duration, [] { return false; });
+    }
+
+    // How often each bottle was found held by someone else, indexed by bottle
+    virtual std::vector<uint64_t> getContention() const = 0;
+};
+
+// Class to manage bottle resources shared among philosophers
+class Bottles : public BottleEngine {
+public:
+    // PRECEDENCE packs a philosopher's id under its ticket in one key; this many ids leave 40 bits for the tickets
+    static constexpr int MAX_PRECEDENCE_PHILOSOPHERS = 1 << 24;
+
+    /**
+      * Constructor initializes the bottles, -1 indicates the bottle is free
+      * @param number_of_bottles Slots in the table.
+      * @param policy How slots are claimed.
+      * @param arbitration Who goes first among philosophers queued for the same bottles.
+      * @param number_of_philosophers One more than the highest philosopher id; only PRECEDENCE needs it.
+      * @throws std::invalid_argument if PRECEDENCE is asked for more than MAX_PRECEDENCE_PHILOSOPHERS.
+      */
+    Bottles(const int number_of_bottles, BottlePolicy policy = PER_BOTTLE_CAS, Arbitration arbitration = {},
+            int number_of_philosophers = 0)
+        : bottles(number_of_bottles), wait_queues(number_of_bottles), contention(number_of_bottles),
+          taken(policy == WORD_MASK ? (number_of_bottles + 63) / 64 : 0), policy(policy), arbitration(arbitration),
+          drank_at(precedenceSlots(arbitration, number_of_philosophers)),
+          id_bits(std::bit_width(static_cast<unsigned>(std::max(number_of_philosophers - 1, 0)))),
+          table_id(StateLogger::openTable(number_of_bottles)) {
+        for (auto &owner: bottles) {
+            owner.store(FREE, std::memory_order_relaxed);
+        }
+        for (auto &ticket: drank_at) {
+            ticket.store(0, std::memory_order_relaxed);
+        }
+        for (auto &word: taken) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+      * Attempts to acquire the specified bottles for a philosopher.
+      * @param philosopher_id The ID of the philosopher attempting to acquire bottles.
+      * @param required_bottles A vector of bottle indices the philosopher requires.
+      * @return True if all bottles are successfully acquired, False otherwise.
+      */
+    bool acquireBottles(int philosopher_id, const std::vector<int> &required_bottles) {
+        if (policy != GLOBAL_MUTEX) {
+            if (!(policy == WORD_MASK ? claimWords(philosopher_id, required_bottles)
+                                      : claimBottles(philosopher_id, required_bottles))) {
+                return false;
+            }
+            StateLogger::logTable(table_id, philosopher_id, TABLE_CLAIMED, required_bottles);
+            return true;
+        }
+
+        std::unique_lock lock(mtx);
+        // Check if all needed bottles are available
+        for (int bottle: required_bottles) {
+            const int owner = bottles[bottle].load(std::memory_order_relaxed);
+            if (owner != FREE && owner != philosopher_id) {
+                contention[bottle].fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        // Acquire all needed bottles
+        for (int bottle: required_bottles) {
+            bottles[bottle].store(philosopher_id, std::memory_order_relaxed);
+        }
+        StateLogger::logTable(table_id, philosopher_id, TABLE_CLAIMED, required_bottles);
+        return true;
+    }
+
+    /**
+      * Blocks until the philosopher owns all of the required bottles.
+      * If the set is not free right away the philosopher is parked on the wait queue of every bottle it needs,
+      * and releaseBottles hands the whole set over and wakes it as soon as the last of them becomes free.
+      * @param philosopher_id The ID of the philosopher acquiring bottles.
+      * @param required_bottles A vector of bottle indices the philosopher requires.
+      * @param stop Gives up the wait when requested; the philosopher then holds none of the bottles.
+      */
+    std::optional<int> acquireBottlesBlocking(int philosopher_id, const std::vector<int> &required_bottles,
+                                              std::stop_token stop = {}) override {
+        // A thread blocks on one set at a time, so one waiter per thread does; a new one per call would allocate
+        thread_local Waiter waiter(philosopher_id);
+        assert(waiter.required_bottles == nullptr);
+        waiter.philosopher_id = philosopher_id;
+        if (acquireBottlesOrQueue(waiter, required_bottles)) {
+            return 0;
+        }
+        bool granted;
+        {
+            std::unique_lock lock(waiter.mtx);
+            granted = waiter.handed_over.wait(lock, stop, [] { return waiter.granted; });
+            // Still under the waiter's lock, so no release can hand the set over after we gave up on it
+            waiter.cancelled = !granted;
+        }
+        leaveQueues(waiter);
+        if (!granted) {
+            return std::nullopt;
+        }
+        return waiter.getRetries();
+    }
+
+    /**
+     * A philosopher queued for its set of bottles. acquireBottlesBlocking keeps one per thread;
+     * callers that cannot park a thread keep one per philosopher and use acquireBottlesOrQueue.
+     */
+    class Waiter {
+    public:
+        /**
+          * @param philosopher_id The ID of the philosopher waiting.
+          * @param on_granted Called once the set has been handed over, from the thread releasing its last bottle
+          *                   and with the wait queues locked; without one the waiting thread is woken instead.
+          */
+        explicit Waiter(int philosopher_id, std::function<void()> on_granted = {})
+            : philosopher_id(philosopher_id), on_granted(std::move(on_granted)) {
+        }
+
+        // Failed attempts at the set during the last acquireBottlesOrQueue; read once it has been granted
+        int getRetries() const {
+            return retries;
+        }
+
+    private:
+        friend class Bottles;
+
+        int philosopher_id;
+        std::function<void()> on_granted;
+        const std::vector<int> *required_bottles = nullptr;
+        uint64_t rank = 0; // Arbitration key while queued, lower goes first
+        std::mutex mtx; // Serializes grant attempts made on the waiter's behalf
+        std::condition_variable_any handed_over;
+        bool granted = false;
+        bool cancelled = false; // Gave up waiting; skipped by releases until it leaves the queues
+        int retries = 0;
+    };
+
+    /**
+      * Non-blocking acquisition: takes the bottles if they are free, otherwise queues the waiter for them.
+      * @param waiter The philosopher's waiter, not queued for anything else.
+      * @param required_bottles Bottle indices the philosopher requires; must stay valid while it is queued.
+      * @return True if the bottles were taken right away. False if the waiter was queued: its on_granted runs
+      *         (possibly before this returns) once they are handed over, after which the caller calls leaveQueues.
+      */
+    bool acquireBottlesOrQueue(Waiter &waiter, const std::vector<int> &required_bottles) {
+        waiter.retries = 0;
+        waiter.rank = rankOf(waiter.philosopher_id);
+        if (!outranked(waiter.rank, required_bottles) && acquireBottles(waiter.philosopher_id, required_bottles)) {
+            return true;
+        }
+        waiter.required_bottles = &required_bottles;
+        waiter.granted = false;
+        waiter.cancelled = false;
+        waiter.retries = 1;
+        for (int bottle: required_bottles) {
+            WaitQueue &queue = wait_queues[bottle];
+            std::unique_lock lock(queue.mtx);
+            queue.waiters.push_back(&waiter);
+            if (waiter.rank < queue.best_rank.load(std::memory_order_relaxed)) {
+                queue.best_rank.store(waiter.rank, std::memory_order_release);
+            }
+        }
+
+        // A release that ran before we were queued could not see us, so check once more
+        grantIfFree(waiter);
+        return false;
+    }
+
+    /**
+      * Gives up the wait of a queued waiter unless its set was handed over already; releases then skip it.
+      * The caller still takes it off the queues with leaveQueues.
+      * @return Whether the set had been handed over, in which case the philosopher holds all of it.
+      */
+    bool cancelWait(Waiter &waiter) {
+        std::unique_lock lock(waiter.mtx);
+        waiter.cancelled = !waiter.granted;
+        return waiter.granted;
+    }
+
+    // Takes a waiter off the wait queues it was put on by acquireBottlesOrQueue, once granted or given up
+    void leaveQueues(Waiter &waiter) {
+        for (int bottle: *waiter.required_bottles) {
+            WaitQueue &queue = wait_queues[bottle];
+            std::unique_lock lock(queue.mtx);
+            auto &waiters = queue.waiters;
+            waiters.erase(std::ranges::find(waiters, &waiter));
+            if (arbitration.kind == Arbitration::GREEDY) {
+                continue;
+            }
+            uint64_t best = NO_RANK;
+            for (const Waiter *other: waiters) {
+                best = std::min(best, other->rank);
+            }
+            queue.best_rank.store(best, std::memory_order_release);
+            // A waiter that gave up never drinks, so nothing else would let the ones it held back try again
+            if (waiter.cancelled) {
+                for (Waiter *other: waiters) {
+                    grantIfFree(*other);
+                }
+            }
+        }
+        waiter.required_bottles = nullptr;
+    }
+
+    /**
+      * Releases all bottles held by the specified philosopher.
+      * This has to look through the whole table for them; philosophers that know their set use the overload below.
+      * @param philosopher_id The ID of the philosopher releasing bottles.
+      */
+    void releaseBottles(int philosopher_id) override {
+        // Only the philosopher itself, or a grant while it is queued, ever makes it an owner, so no lock is needed
+        std::vector<int> held;
+        for (size_t i = 0; i < bottles.size(); ++i) {
+            if (bottles[i].load(std::memory_order_relaxed) == philosopher_id) {
+                held.push_back(static_cast<int>(i));
+            }
+        }
+        releaseBottles(philosopher_id, held);
+    }
+
+    /**
+      * Releases the given bottles, skipping any the philosopher does not hold, in time proportional to their number.
+      * Parked philosophers queued on any released bottle whose full set is now free are handed it and woken.
+      * @param philosopher_id The ID of the philosopher releasing bottles.
+      * @param held The bottles it acquired for its current drink.
+      */
+    void releaseBottles(int philosopher_id, std::span<const int> held) override {
+        const Request request{philosopher_id, held};
+        releaseBatch(std::span(&request, 1));
+    }
+
+    // One owner's set of bottles in a batch
+    struct Request {
+        int philosopher_id;
+        std::span<const int> bottles;
+    };
+
+    /**
+      * Settles many all-or-nothing requests in one pass, as a greedy maximal independent set of the conflict graph:
+      * requests are taken in order and each is granted unless it needs a bottle held by someone else or granted
+      * to an earlier request of the batch, or a better-ranked philosopher is queued for one. The mutex policy takes
+      * its lock once for the whole batch, the mask policy claims each word once for every request granted in it,
+      * and requests that already lost inside the batch never touch the shared table. Requests that are not granted
+      * are not queued either; callers resubmit them.
+      * @param requests Sets to claim, in order of preference.
+      * @return Grant bitmap: bit i % 64 of word i / 64 is set if requests[i] now holds all of its bottles.
+      * @throws std::invalid_argument if an owner id is negative, or not below number_of_philosophers under
+      *         PRECEDENCE; nothing is claimed then.
+      */
+    std::vector<uint64_t> acquireBatch(std::span<const Request> requests) {
+        checkOwners(requests);
+        std::vector<uint64_t> granted((requests.size() + 63) / 64);
+        // [bottle] = epoch of the last batch on this thread that granted it, so the marks never need clearing
+        thread_local std::vector<uint64_t> batch_marks;
+        thread_local uint64_t batch_epoch = 0;
+        if (batch_marks.size() < bottles.size()) {
+            batch_marks.resize(bottles.size());
+        }
+        const uint64_t epoch = ++batch_epoch;
+        const auto grant = [&](size_t idx) {
+            granted[idx / 64] |= uint64_t{1} << (idx % 64);
+            for (int bottle: requests[idx].bottles) {
+                batch_marks[bottle] = epoch;
+            }
+        };
+        // Free of earlier grants in the batch and of better-ranked waiters; the table itself is checked separately
+        const auto eligible = [&](const Request &request) {
+            return std::ranges::none_of(request.bottles, [&](int bottle) { return batch_marks[bottle] == epoch; }) &&
+                   !outranked(rankOf(request.philosopher_id), request.bottles);
+        };
+        const auto heldByOther = [&](const Request &request) {
+            for (int bottle: request.bottles) {
+                const int owner = ownerOf(bottles[bottle].load(std::memory_order_relaxed));
+                if (owner != FREE && owner != request.philosopher_id) {
+                    contention[bottle].fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        if (policy == GLOBAL_MUTEX) {
+            std::unique_lock lock(mtx);
+            for (size_t idx = 0; idx < requests.size(); ++idx) {
+                const Request &request = requests[idx];
+                if (!eligible(request) || heldByOther(request)) {
+                    continue;
+                }
+                for (int bottle: request.bottles) {
+                    bottles[bottle].store(request.philosopher_id, std::memory_order_relaxed);
+                }
+                grant(idx);
+                StateLogger::logTable(table_id, request.philosopher_id, TABLE_CLAIMED, request.bottles);
+            }
+            return granted;
+        }
+
+        if (policy == PER_BOTTLE_CAS) {
+            for (size_t idx = 0; idx < requests.size(); ++idx) {
+                const Request &request = requests[idx];
+                if (eligible(request) && !heldByOther(request) &&
+                    claimBottles(request.philosopher_id, request.bottles)) {
+                    grant(idx);
+                    StateLogger::logTable(table_id, request.philosopher_id, TABLE_CLAIMED, request.bottles);
+                }
+            }
+            return granted;
+        }
+
+        // WORD_MASK: pick the independent set against a snapshot of the table, then claim it a word at a time
+        std::vector<std::pair<int, size_t> > wanted_bits; // (bottle, request) for every bit still to be set
+        for (size_t idx = 0; idx < requests.size(); ++idx) {
+            const Request &request = requests[idx];
+            if (!eligible(request) || heldByOther(request)) {
+                continue;
+            }
+            grant(idx);
+            for (int bottle: request.bottles) {
+                if (bottles[bottle].load(std::memory_order_relaxed) != request.philosopher_id) {
+                    wanted_bits.emplace_back(bottle, idx);
+                }
+            }
+        }
+        std::ranges::sort(wanted_bits);
+        const auto isGranted = [&](size_t idx) { return granted[idx / 64] >> (idx % 64) & 1; };
+        std::vector<char> claimed(wanted_bits.size(), false);
+        for (size_t run = 0, end; run < wanted_bits.size(); run = end) {
+            const size_t word = static_cast<size_t>(wanted_bits[run].first) / 64;
+            for (end = run; end < wanted_bits.size() && static_cast<size_t>(wanted_bits[end].first) / 64 == word;
+                 ++end) {
+            }
+            uint64_t wanted;
+            uint64_t current = taken[word].load(std::memory_order_relaxed);
+            do {
+                wanted = 0;
+                for (size_t i = run; i < end; ++i) {
+                    if (isGranted(wanted_bits[i].second)) {
+                        wanted |= bitOf(wanted_bits[i].first);
+                    }
+                }
+                // Whoever took a bit since the snapshot wins it; the requests that wanted it drop out of the batch
+                for (size_t i = run; i < end && (current & wanted); ++i) {
+                    const auto [bottle, idx] = wanted_bits[i];
+                    if (isGranted(idx) && (current & bitOf(bottle))) {
+                        granted[idx / 64] &= ~(uint64_t{1} << (idx % 64));
+                        contention[bottle].fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            } while ((current & wanted) != 0 ||
+                     (wanted != 0 && !taken[word].compare_exchange_weak(current, current | wanted,
+                                                                        std::memory_order_acquire,
+                                                                        std::memory_order_relaxed)));
+            for (size_t i = run; i < end; ++i) {
+                claimed[i] = isGranted(wanted_bits[i].second);
+            }
+        }
+
+        // Hand back what requests that dropped out in a later word had already claimed in earlier ones
+        for (size_t i = 0; i < wanted_bits.size(); ++i) {
+            if (claimed[i] && !isGranted(wanted_bits[i].second)) {
+                taken[wanted_bits[i].first / 64].fetch_and(~bitOf(wanted_bits[i].first), std::memory_order_release);
+            }
+        }
+        for (size_t idx = 0; idx < requests.size(); ++idx) {
+            if (isGranted(idx)) {
+                for (int bottle: requests[idx].bottles) {
+                    bottles[bottle].store(requests[idx].philosopher_id, std::memory_order_relaxed);
+                }
+                StateLogger::logTable(table_id, requests[idx].philosopher_id, TABLE_CLAIMED, requests[idx].bottles);
+            }
+        }
+        return granted;
+    }
+
+    /**
+      * Releases every request's bottles, skipping any its philosopher does not hold, as releaseBottles would one
+      * request at a time; the mutex policy locks once and the mask policy clears each word once for the batch.
+      * Under PRECEDENCE every request counts as its philosopher's latest drink, whether or not it held anything,
+      * so it ranks behind everyone who has not drunk since.
+      * @param requests Sets held by their philosophers, typically the ones acquireBatch granted.
+      * @throws std::invalid_argument as acquireBatch does; nothing is released then.
+      */
+    void releaseBatch(std::span<const Request> requests) {
+        checkOwners(requests);
+        // Per thread and only ever cleared, so steady-state releases do not allocate; nothing below releases again
+        thread_local std::vector<int> released; // Every request's freed bottles, one request after the other
+        thread_local std::vector<size_t> released_end; // [request] = end of its run in released
+        released.clear();
+        released_end.resize(requests.size());
+        {
+            std::unique_lock<std::mutex> lock;
+            if (policy == GLOBAL_MUTEX) {
+                lock = std::unique_lock(mtx);
+            }
+            for (size_t idx = 0; idx < requests.size(); ++idx) {
+                for (int bottle: requests[idx].bottles) {
+                    if (bottles[bottle].load(std::memory_order_relaxed) == requests[idx].philosopher_id) {
+                        bottles[bottle].store(FREE, std::memory_order_release);
+                        released.push_back(bottle);
+                    }
+                }
+                released_end[idx] = released.size();
+            }
+            if (policy == WORD_MASK) {
+                // Owners are cleared first, so a set bit whose owner reads as us is always really ours
+                std::vector<int> by_word;
+                std::span<const int> order = released;
+                if (requests.size() > 1) {
+                    by_word = released;
+                    std::ranges::sort(by_word);
+                    order = by_word;
+                }
+                for (size_t run = 0; run < order.size();) {
+                    const size_t word = static_cast<size_t>(order[run]) / 64;
+                    uint64_t mask = 0;
+                    for (; run < order.size() && static_cast<size_t>(order[run]) / 64 == word; ++run) {
+                        mask |= bitOf(order[run]);
+                    }
+                    taken[word].fetch_and(~mask, std::memory_order_release);
+                }
+            }
+            for (size_t idx = 0, begin = 0; idx < requests.size(); begin = released_end[idx++]) {
+                StateLogger::logTable(table_id, requests[idx].philosopher_id, TABLE_FREED,
+                                      std::span(released).subspan(begin, released_end[idx] - begin));
+            }
+        }
+        if (!drank_at.empty()) {
+            for (const Request &request: requests) {
+                drank_at[request.philosopher_id].store(drink_clock.fetch_add(1, std::memory_order_relaxed) + 1,
+                                                       std::memory_order_relaxed);
+            }
+        }
+
+        for (int bottle: released) {
+            std::unique_lock lock(wait_queues[bottle].mtx);
+            for (Waiter *waiter: wait_queues[bottle].waiters) {
+                grantIfFree(*waiter);
+            }
+        }
+    }
+
+    BottlePolicy getPolicy() const {
+        return policy;
+    }
+
+    const Arbitration &getArbitration() const {
+        return arbitration;
+    }
+
+    // Owner of every bottle, each read lock-free as of its own moment; FREE while free or still being claimed
+    std::vector<int> getOwners() const {
+        std::vector<int> owners;
+        owners.reserve(bottles.size());
+        for (const auto &owner: bottles) {
+            const int slot = owner.load(std::memory_order_relaxed);
+            owners.push_back(slot < FREE ? FREE : slot);
+        }
+        return owners;
+    }
+
+    // Moves each partition's slice of the owner, wait queue, contention and mask arrays onto its node's memory
+    void bindToNodes(const placement::Plan &plan) {
+        plan.bindByBottle(std::span(bottles));
+        plan.bindByBottle(std::span(wait_queues));
+        plan.bindByBottle(std::span(contention));
+        std::vector<int> word_begin;
+        for (int bottle: plan.bottle_begin) {
+            word_begin.push_back((bottle + 63) / 64);
+        }
+        plan.bindSlices(std::span(taken), word_begin);
+    }
+
+    std::vector<uint64_t> getContention() const override {
+        std::vector<uint64_t> counts;
+        counts.reserve(contention.size());
+        for (const auto &count: contention) {
+            counts.push_back(count.load(std::memory_order_relaxed));
+        }
+        return counts;
+    }
+
+private:
+    static constexpr int FREE = -1;
+
+    static constexpr uint64_t NO_RANK = UINT64_MAX;
+
+    // FIFO of philosophers waiting for one bottle
+    struct WaitQueue {
+        std::mutex mtx;
+        std::vector<Waiter *> waiters;
+        std::atomic<uint64_t> best_rank = NO_RANK; // Lowest rank in waiters, so claims can check it without mtx
+    };
+
+    std::vector<std::atomic<int> > bottles; // [bottle] = owning philosopher, FREE when nobody holds it
+    std::vector<WaitQueue> wait_queues; // [bottle] = philosophers parked until it is released
+    std::vector<std::atomic<uint64_t> > contention; // [bottle] = failed claims that found it taken
+    std::vector<std::atomic<uint64_t> > taken; // WORD_MASK only: bit b % 64 of word b / 64 set while b is held
+    BottlePolicy policy;
+    Arbitration arbitration;
+    std::vector<std::atomic<uint64_t> > drank_at; // PRECEDENCE only: [philosopher] = drink_clock at its last release
+    std::atomic<uint64_t> drink_clock = 0;
+    int id_bits; // PRECEDENCE only: low bits of a rank holding the philosopher id, enough for the highest one
+    uint16_t table_id; // Identifies this table's records in the log
+    std::mutex mtx; // Only taken under GLOBAL_MUTEX
+
+    // Batch owner ids come from callers; they index drank_at and must not read as FREE
+    void checkOwners(std::span<const Request> requests) const {
+        for (const Request &request: requests) {
+            if (request.philosopher_id < 0 ||
+                (!drank_at.empty() && request.philosopher_id >= static_cast<int>(drank_at.size()))) {
+                throw std::invalid_argument("bad batch owner " + std::to_string(request.philosopher_id));
+            }
+        }
+    }
+
+    // Tickets drank_at keeps, one per philosopher under PRECEDENCE; checked before the table is announced
+    static size_t precedenceSlots(const Arbitration &arbitration, int number_of_philosophers) {
+        if (arbitration.kind != Arbitration::PRECEDENCE) {
+            return 0;
+        }
+        if (number_of_philosophers > MAX_PRECEDENCE_PHILOSOPHERS) {
+            throw std::invalid_argument("precedence arbitration takes at most " +
+                                        std::to_string(MAX_PRECEDENCE_PHILOSOPHERS) + " philosophers");
+        }
+        return static_cast<size_t>(std::max(number_of_philosophers, 0));
+    }
+
+    // Claims the waiter's whole set on its behalf if it is free and wakes it; a no-op once it has been granted
+    void grantIfFree(Waiter &waiter) {
+        std::unique_lock lock(waiter.mtx);
+        if (waiter.granted || waiter.cancelled) {
+            return;
+        }
+        if (outranked(waiter.rank, *waiter.required_bottles) ||
+            !acquireBottles(waiter.philosopher_id, *waiter.required_bottles)) {
+            ++waiter.retries;
+            return;
+        }
+        waiter.granted = true;
+        if (waiter.on_granted) {
+            waiter.on_granted();
+        } else {
+            waiter.handed_over.notify_one();
+        }
+    }
+
+    /*
+     * Arbitration key of a philosopher asking now. FIFO and AGING rank by when it asked, on the log's clock so the
+     * discrete-event driver ages waiters in simulated time. PRECEDENCE ranks by its last drink, with the id in the
+     * id_bits below it breaking ties, which is a total order and so keeps the precedence graph acyclic.
+     */
+    uint64_t rankOf(int philosopher_id) const {
+        switch (arbitration.kind) {
+            case Arbitration::GREEDY: return NO_RANK;
+            case Arbitration::PRECEDENCE:
+                assert(philosopher_id < static_cast<int>(drank_at.size()));
+                return drank_at[philosopher_id].load(std::memory_order_relaxed) << id_bits |
+                       static_cast<uint64_t>(philosopher_id);
+            default: return static_cast<uint64_t>(StateLogger::now());
+        }
+    }
+
+    // Whether a better-ranked philosopher is queued for any of the bottles, so a claim at this rank has to wait
+    bool outranked(uint64_t rank, std::span<const int> required_bottles) const {
+        if (arbitration.kind == Arbitration::GREEDY) {
+            return false;
+        }
+        const uint64_t now = arbitration.kind == Arbitration::AGING ? StateLogger::now() : 0;
+        const uint64_t limit_ns = std::chrono::nanoseconds(arbitration.age_limit).count();
+        for (int bottle: required_bottles) {
+            const uint64_t best = wait_queues[bottle].best_rank.load(std::memory_order_acquire);
+            if (best < rank && (arbitration.kind != Arbitration::AGING || now - best >= limit_ns)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * While an acquisition is in flight its claims are marked with -(id + 2) rather than the id itself,
+     * so a failed attempt rolls back exactly what it claimed and leaves bottles it already held untouched.
+     */
+    static int pendingMarker(int philosopher_id) {
+        return -(philosopher_id + 2);
+    }
+
+    static int ownerOf(int slot) {
+        return slot < FREE ? -(slot + 2) : slot;
+    }
+
+    static uint64_t bitOf(int bottle) {
+        return uint64_t{1} << (bottle % 64);
+    }
+
+    // Sorts into scratch only when needed, so the common already-sorted set is claimed without copying
+    static std::span<const int> ascending(std::span<const int> required_bottles, std::vector<int> &scratch) {
+        if (std::is_sorted(required_bottles.begin(), required_bottles.end())) {
+            return required_bottles;
+        }
+        scratch.assign(required_bottles.begin(), required_bottles.end());
+        std::ranges::sort(scratch);
+        return scratch;
+    }
+
+    /**
+     * Lock-free all-or-nothing claim over the taken bitset. Bottles sharing a 64-bit word are tested and claimed
+     * together by one compare-and-swap, and words are claimed in ascending order like claimBottles does with slots.
+     * Owners are only written once the whole set is claimed; they tell which set bits already belong to us.
+     * @return True if every bottle is now owned by the philosopher, False if a word was contended and rolled back.
+     */
+    bool claimWords(int philosopher_id, std::span<const int> required_bottles) {
+        thread_local std::vector<int> scratch; // Keeps its capacity, so sorting a set allocates only the first time
+        const std::span<const int> order = ascending(required_bottles, scratch);
+
+        // Bits of the run of bottles starting at begin that share its word, minus the ones we already hold
+        const auto wantedIn = [&](size_t begin, size_t &end) {
+            uint64_t wanted = 0;
+            const size_t word = static_cast<size_t>(order[begin]) / 64;
+            for (end = begin; end < order.size() && static_cast<size_t>(order[end]) / 64 == word; ++end) {
+                if (bottles[order[end]].load(std::memory_order_relaxed) != philosopher_id) {
+                    wanted |= bitOf(order[end]);
+                }
+            }
+            return wanted;
+        };
+
+        size_t run = 0;
+        for (size_t end; run < order.size(); run = end) {
+            const uint64_t wanted = wantedIn(run, end);
+            auto &word = taken[order[run] / 64];
+            uint64_t current = word.load(std::memory_order_relaxed);
+            while ((current & wanted) == 0 &&
+                   !word.compare_exchange_weak(current, current | wanted, std::memory_order_acquire,
+                                               std::memory_order_relaxed)) {
+            }
+            if (current & wanted) {
+                contention[order[run] / 64 * 64 + std::countr_zero(current & wanted)].fetch_add(
+                    1, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        if (run < order.size()) {
+            for (size_t undo = 0, end; undo < run; undo = end) {
+                taken[order[undo] / 64].fetch_and(~wantedIn(undo, end), std::memory_order_release);
+            }
+            return false;
+        }
+        for (int bottle: order) {
+            bottles[bottle].store(philosopher_id, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /**
+     * Lock-free all-or-nothing claim of the required bottles.
+     * Bottles are claimed in ascending index order, so two philosophers competing for overlapping sets always
+     * collide on the lowest shared bottle first and the loser backs off before holding anything the winner needs.
+     * @return True if every bottle is now owned by the philosopher, False if a claim failed and was rolled back.
+     */
+    bool claimBottles(int philosopher_id, std::span<const int> required_bottles) {
+        thread_local std::vector<int> scratch; // Keeps its capacity, so sorting a set allocates only the first time
+        const std::span<const int> order = ascending(required_bottles, scratch);
+
+        const int pending = pendingMarker(philosopher_id);
+        size_t claimed = 0;
+        for (; claimed < order.size(); ++claimed) {
+            int expected = FREE;
+            if (bottles[order[claimed]].compare_exchange_strong(expected, pending, std::memory_order_acquire,
+                                                                std::memory_order_relaxed)) {
+                continue;
+            }
+            if (expected != philosopher_id && expected != pending) {
+                contention[order[claimed]].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        // Success publishes the claims under the real id, failure hands them back
+        const int outcome = claimed == order.size() ? philosopher_id : FREE;
+        for (size_t i = 0; i < claimed; ++i) {
+            auto &owner = bottles[order[i]];
+            if (owner.load(std::memory_order_relaxed) == pending) {
+                owner.store(outcome, std::memory_order_release);
+            }
+        }
+        return outcome == philosopher_id;
+    }
+};
+
+/**
+ * Message-passing bottle engine after Chandy and Misra's drinking philosophers: there is no central table.
+ * Every bottle is a token held by exactly one of its two endpoints, together with a request token that tells
+ * which side may ask for it next. A bottle arrives clean and turns dirty once it has been drunk from.
+ * Conflicts between two thirsty philosophers are settled by the Lamport timestamp of their thirst, which stands in
+ * for the dining layer of the original algorithm: a thirsty holder keeps a needed bottle if it is still clean or if
+ * its own thirst is older, and hands it over otherwise. The older request always wins, so the wait-for relation
+ * cannot form a cycle, and clocks only move forward, so every thirst eventually becomes the oldest one around.
+ * All of a philosopher's bookkeeping is private to its thread; neighbours only ever touch its lock-free mailbox.
+ */
+class MessagePassingBottles : public BottleEngine {
+public:
+    // A message bound for a philosopher another process runs, in the fixed layout it crosses the network in
+    struct Envelope {
+        uint32_t kind; // Message::Kind
+        int32_t bottle;
+        int32_t sender;
+        int32_t receiver;
+        uint64_t timestamp;
+    };
+
+    /**
+     * The slice of the graph this process runs when the philosophers are spread over several processes.
+     * Every process builds the engine for the whole graph and deals out the same initial tokens, but only ever
+     * touches the seats of its own philosophers.
+     */
+    struct Shard {
+        int first = 0; // First philosopher run here
+        int last = INT_MAX; // One past the last
+        std::function<void(const Envelope &)> outbox; // Carries messages for everyone else; called concurrently
+    };
+
+    /**
+      * Deals out the initial tokens: each bottle starts dirty at its lower-numbered endpoint,
+      * and the request token sits with the other one.
+      * @param graph The topology whose edges define which philosophers share each bottle.
+      * @param number_of_bottles One more than the highest bottle id used by the graph.
+      * @param shard The philosophers run by this process.
+      */
+    MessagePassingBottles(const Graph &graph, int number_of_bottles, Shard shard)
+        : seats(graph.getNumberOfVertices()), endpoints(number_of_bottles, {-1, -1}), contention(number_of_bottles),
+          shard(std::move(shard)) {
+        for (int philosopher = 0; philosopher < graph.getNumberOfVertices(); ++philosopher) {
+            Seat &seat = seats[philosopher];
+            const auto adjacent = graph.getAdjacentBottles(philosopher);
+            seat.bottle_ids.assign(adjacent.begin(), adjacent.end());
+            std::ranges::sort(seat.bottle_ids);
+            seat.holdings.resize(seat.bottle_ids.size());
+            for (int bottle: seat.bottle_ids) {
+                auto &[low, high] = endpoints[bottle];
+                if (low == -1) {
+                    low = philosopher;
+                } else {
+                    high = std::max(low, philosopher);
+                    low = std::min(low, philosopher);
+                }
+            }
+        }
+        for (int philosopher = 0; philosopher < graph.getNumberOfVertices(); ++philosopher) {
+            Seat &seat = seats[philosopher];
+            for (size_t i = 0; i < seat.bottle_ids.size(); ++i) {
+                const bool lower = endpoints[seat.bottle_ids[i]].first == philosopher;
+                seat.holdings[i].bottle = lower;
+                seat.holdings[i].dirty = true;
+                seat.holdings[i].request_token = !lower;
+            }
+        }
+    }
+
+    // Same, for a process that runs every philosopher itself
+    MessagePassingBottles(const Graph &graph, int number_of_bottles)
+        : MessagePassingBottles(graph, number_of_bottles, Shard()) {
+    }
+
+    /**
+      * Requests every missing bottle from the neighbour holding it, then answers the mailbox until they all arrived.
+      * @param philosopher_id The ID of the philosopher acquiring bottles.
+      * @param required_bottles Bottle indices the philosopher requires, all of them adjacent to it.
+      * @param stop Gives up the wait when requested; releaseBottles then hands back whatever had arrived.
+      */
+    std::optional<int> acquireBottlesBlocking(int philosopher_id, const std::vector<int> &required_bottles,
+                                              std::stop_token stop = {}) override {
+        Seat &seat = seats[philosopher_id];
+        seat.phase = THIRSTY;
+        seat.thirst_since = ++seat.clock;
+        seat.missing = 0;
+        seat.retries = 0;
+        for (int bottle: required_bottles) {
+            Holding &holding = holdingOf(seat, bottle);
+            holding.needed = true;
+            if (holding.bottle) {
+                continue;
+            }
+            ++seat.missing;
+            if (holding.request_token) {
+                holding.request_token = false;
+                send(peerOf(philosopher_id, bottle), {Message::REQUEST, bottle, philosopher_id, seat.thirst_since});
+            }
+        }
+        while (seat.missing > 0) {
+            if (!seat.mailbox.waitUntil(std::chrono::steady_clock::time_point::max(), stop)) {
+                return std::nullopt;
+            }
+            serveMailbox(philosopher_id);
+        }
+        seat.phase = DRINKING;
+        return seat.retries;
+    }
+
+    /**
+      * Marks the bottles just drunk from as dirty and hands over every one a neighbour asked for meanwhile.
+      * @param philosopher_id The ID of the philosopher releasing bottles.
+      */
+    void releaseBottles(int philosopher_id) override {
+        Seat &seat = seats[philosopher_id];
+        seat.phase = TRANQUIL;
+        for (size_t i = 0; i < seat.holdings.size(); ++i) {
+            Holding &holding = seat.holdings[i];
+            if (holding.needed) {
+                holding.needed = false;
+                holding.dirty = true;
+            }
+            if (holding.bottle && holding.request_token) {
+                handOver(philosopher_id, seat.bottle_ids[i], holding);
+            }
+        }
+    }
+
+    // Keeps answering the neighbours' requests until the time is up or stop is requested
+    void idle(int philosopher_id, std::chrono::milliseconds duration, std::stop_token stop = {}) override {
+        const auto deadline = std::chrono::steady_clock::now() + duration;
+        Seat &seat = seats[philosopher_id];
+        do {
+            serveMailbox(philosopher_id);
+        } while (seat.mailbox.waitUntil(deadline, stop));
+        serveMailbox(philosopher_id);
+    }
+
+    // Counts requests that had to wait because the holder kept the bottle
+    std::vector<uint64_t> getContention() const override {
+        std::vector<uint64_t> counts;
+        counts.reserve(contention.size());
+        for (const auto &count: contention) {
+            counts.push_back(count.load(std::memory_order_relaxed));
+        }
+        return counts;
+    }
+
+    // Whether the philosopher currently holds the bottle token; only meaningful from the philosopher's own thread
+    bool holdsBottle(int philosopher_id, int bottle) {
+        return holdingOf(seats[philosopher_id], bottle).bottle;
+    }
+
+    /**
+      * Hands a message that came in from another process to the local philosopher it is addressed to.
+      * @return False, with nothing delivered, if no well-behaved peer could have sent it: the kind is unknown, the
+      *         receiver is not run here, or the bottle is not one that sender and receiver share.
+      */
+    bool deliver(const Envelope &envelope) {
+        if (envelope.kind > Message::BOTTLE || envelope.receiver < std::max(shard.first, 0) ||
+            envelope.receiver >= std::min(shard.last, static_cast<int>(seats.size())) || envelope.bottle < 0 ||
+            envelope.bottle >= static_cast<int>(endpoints.size())) {
+            return false;
+        }
+        const auto [low, high] = std::minmax(envelope.sender, envelope.receiver);
+        if (endpoints[envelope.bottle] != std::pair(low, high)) {
+            return false;
+        }
+        seats[envelope.receiver].mailbox.post(new Message{static_cast<Message::Kind>(envelope.kind), envelope.bottle,
+                                                          envelope.sender, envelope.timestamp});
+        return true;
+    }
+
+private:
+    struct Message {
+        enum Kind { REQUEST, BOTTLE };
+
+        Kind kind;
+        int bottle;
+        int sender;
+        uint64_t timestamp; // Lamport time of the sender's thirst for REQUEST, of the hand-over for BOTTLE
+        Message *next = nullptr;
+    };
+
+    /*
+     * Multi-producer single-consumer mailbox. Senders push onto a Treiber stack with one CAS; the owner swaps the
+     * whole stack out at once and reverses it back into arrival order. The owner only takes the parking mutex
+     * when it has nothing to do, and senders only touch it to wake a parked owner.
+     */
+    class Mailbox {
+    public:
+        ~Mailbox() {
+            for (Message *message = top.load(); message != nullptr;) {
+                delete std::exchange(message, message->next);
+            }
+        }
+
+        void post(Message *message) {
+            message->next = top.load(std::memory_order_relaxed);
+            while (!top.compare_exchange_weak(message->next, message, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+            }
+            if (parked.load(std::memory_order_seq_cst)) {
+                std::unique_lock lock(park_mtx);
+                wake.notify_one();
+            }
+        }
+
+        // Takes every pending message, oldest first
+        Message *takeAll() {
+            Message *reversed = nullptr;
+            for (Message *message = top.exchange(nullptr, std::memory_order_acquire); message != nullptr;) {
+                Message *next = message->next;
+                message->next = reversed;
+                reversed = message;
+                message = next;
+            }
+            return reversed;
+        }
+
+        // Parks the owner until a message is pending, the deadline passes or stop is requested; false unless a message
+        bool waitUntil(std::chrono::steady_clock::time_point deadline, std::stop_token stop = {}) {
+            std::unique_lock lock(park_mtx);
+            parked.store(true, std::memory_order_seq_cst);
+            const auto pending = [this] { return top.load(std::memory_order_seq_cst) != nullptr; };
+            bool woken = deadline == std::chrono::steady_clock::time_point::max()
+                             ? wake.wait(lock, stop, pending)
+                             : wake.wait_until(lock, stop, deadline, pending);
+            parked.store(false, std::memory_order_relaxed);
+            return woken;
+        }
+
+    private:
+        std::atomic<Message *> top = nullptr;
+        std::atomic<bool> parked = false;
+        std::mutex park_mtx;
+        std::condition_variable_any wake;
+    };
+
+    // What a philosopher knows about one of its adjacent bottles
+    struct Holding {
+        bool bottle = false; // The bottle token is here
+        bool dirty = true; // Drunk from since it arrived
+        bool request_token = false; // Here with the bottle: the neighbour asked for it; here alone: we may ask
+        bool needed = false; // Part of the current thirst
+    };
+
+    // A philosopher's mailbox and its private bookkeeping
+    struct Seat {
+        Mailbox mailbox;
+        std::vector<int> bottle_ids; // Adjacent bottles, sorted
+        std::vector<Holding> holdings; // Parallel to bottle_ids
+        State phase = TRANQUIL;
+        uint64_t clock = 0; // Lamport clock
+        uint64_t thirst_since = 0; // Timestamp of the current thirst
+        int missing = 0; // Needed bottles still to arrive
+        int retries = 0; // Needed bottles handed away and asked for again during the current thirst
+    };
+
+    std::vector<Seat> seats; // [philosopher]
+    std::vector<std::pair<int, int> > endpoints; // [bottle] = the two philosophers sharing it
+    std::vector<std::atomic<uint64_t> > contention; // [bottle] = requests deferred by its holder
+    Shard shard;
+
+    Holding &holdingOf(Seat &seat, int bottle) {
+        const auto it = std::ranges::lower_bound(seat.bottle_ids, bottle);
+        assert(it != seat.bottle_ids.end() && *it == bottle);
+        return seat.holdings[it - seat.bottle_ids.begin()];
+    }
+
+    int peerOf(int philosopher_id, int bottle) const {
+        const auto &[low, high] = endpoints[bottle];
+        return low == philosopher_id ? high : low;
+    }
+
+    void send(int philosopher_id, const Message &message) {
+        if (philosopher_id < shard.first || philosopher_id >= shard.last) {
+            shard.outbox({message.kind, message.bottle, message.sender, philosopher_id, message.timestamp});
+            return;
+        }
+        seats[philosopher_id].mailbox.post(new Message(message));
+    }
+
+    void handOver(int philosopher_id, int bottle, Holding &holding) {
+        holding.bottle = false;
+        send(peerOf(philosopher_id, bottle), {Message::BOTTLE, bottle, philosopher_id, seats[philosopher_id].clock});
+    }
+
+    // Whether a request from a neighbour whose thirst started at (timestamp, requester) has to wait
+    bool keeps(const Seat &seat, const Holding &holding, int philosopher_id, uint64_t timestamp, int requester) {
+        if (!holding.needed || seat.phase == TRANQUIL) {
+            return false;
+        }
+        if (seat.phase == DRINKING || !holding.dirty) {
+            return true;
+        }
+        return std::pair(seat.thirst_since, philosopher_id) < std::pair(timestamp, requester);
+    }
+
+    void serveMailbox(int philosopher_id) {
+        Seat &seat = seats[philosopher_id];
+        for (Message *message = seat.mailbox.takeAll(); message != nullptr;) {
+            seat.clock = std::max(seat.clock, message->timestamp) + 1;
+            Holding &holding = holdingOf(seat, message->bottle);
+            if (message->kind == Message::BOTTLE) {
+                holding.bottle = true;
+                holding.dirty = false;
+                if (holding.needed) {
+                    --seat.missing;
+                }
+            } else {
+                holding.request_token = true;
+                if (keeps(seat, holding, philosopher_id, message->timestamp, message->sender)) {
+                    contention[message->bottle].fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    handOver(philosopher_id, message->bottle, holding);
+                    if (holding.needed) {
+                        // Still thirsty for it: ask for it straight back, the neighbour's older thirst goes first
+                        ++seat.missing;
+                        ++seat.retries;
+                        holding.request_token = false;
+                        send(message->sender, {Message::REQUEST, message->bottle, philosopher_id, seat.thirst_since});
+                    }
+                }
+            }
+            delete std::exchange(message, message->next);
+        }
+    }
+};
+
+// Small blocking socket helpers shared by the distributed transport and the status endpoint
+namespace net {
+    inline std::pair<std::string, std::string> split(const std::string &address) {
+        const size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("address " + address + " has no port");
+        }
+        return {address.substr(0, colon), address.substr(colon + 1)};
+    }
+
+    inline addrinfo *resolve(const std::string &address, bool passive) {
+        const auto [name, port] = split(address);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(name.empty() ? nullptr : name.c_str(), port.c_str(), &hints, &found) != 0) {
+            throw std::runtime_error("cannot resolve " + address);
+        }
+        return found;
+    }
+
+    // Listens on "name:port", or on every interface for ":port"
+    inline int listenOn(const std::string &address) {
+        addrinfo *found = resolve(address, true);
+        const int socket = ::socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+        const int on = 1;
+        setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        const bool listening = socket >= 0 && bind(socket, found->ai_addr, found->ai_addrlen) == 0 &&
+                               listen(socket, SOMAXCONN) == 0;
+        freeaddrinfo(found);
+        if (!listening) {
+            if (socket >= 0) {
+                close(socket);
+            }
+            throw std::runtime_error("cannot listen on " + address);
+        }
+        return socket;
+    }
+
+    // Listens on a Unix domain socket, replacing a stale one left at path
+    inline int listenOnUnix(const std::string &path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("socket path too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        const int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket < 0 || bind(socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+            listen(socket, SOMAXCONN) != 0) {
+            if (socket >= 0) {
+                close(socket);
+            }
+            throw std::runtime_error("cannot listen on " + path);
+        }
+        return socket;
+    }
+
+    // Keeps retrying until the deadline, since the other side may not be listening yet
+    inline int connectTo(const std::string &address, std::chrono::steady_clock::time_point deadline) {
+        addrinfo *found = resolve(address, false);
+        while (true) {
+            const int socket = ::socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+            if (socket >= 0 && connect(socket, found->ai_addr, found->ai_addrlen) == 0) {
+                freeaddrinfo(found);
+                return socket;
+            }
+            if (socket >= 0) {
+                close(socket);
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                freeaddrinfo(found);
+                throw std::runtime_error("cannot connect to " + address);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    // Whether the socket has something to read, or a connection to accept, before the deadline
+    inline bool waitReadable(int socket, std::chrono::steady_clock::time_point deadline) {
+        while (true) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd ready{socket, POLLIN, 0};
+            const int polled = poll(&ready, 1, static_cast<int>(std::max<int64_t>(left.count(), 0)));
+            if (polled >= 0 || errno != EINTR) {
+                return polled > 0;
+            }
+        }
+    }
+
+    inline bool writeAll(int socket, const void *data, size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            const ssize_t written = ::send(socket, bytes, size, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    inline bool readAll(int socket, void *data, size_t size) {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0) {
+            const ssize_t read = recv(socket, bytes, size, 0);
+            if (read <= 0) {
+                return false;
+            }
+            bytes += read;
+            size -= read;
+        }
+        return true;
+    }
+}
+
+/**
+ * Carries MessagePassingBottles envelopes between the processes sharing one graph, over one TCP connection per pair.
+ * Sends never wait for the network: envelopes are appended to the batch of the destination host and a single
+ * flusher thread writes every pending batch as one frame, after lingering briefly so a burst of requests and
+ * hand-overs shares a round trip. Many frames can be in flight at once; nothing waits for an answer. A reader
+ * thread per peer decodes its frames and hands the envelopes on. Frames are a 32-bit envelope count followed by the
+ * envelopes themselves in host byte order, so all hosts have to share one.
+ */
+class TcpTransport {
+public:
+    using Envelope = MessagePassingBottles::Envelope;
+    static_assert(std::is_trivially_copyable_v<Envelope> && sizeof(Envelope) == 24, "envelopes are sent as raw bytes");
+
+    static constexpr size_t MAX_BATCH = 512; // Envelopes that make the flusher stop lingering, and the most per frame
+    static constexpr auto LINGER = std::chrono::microseconds(100);
+
+    /**
+      * Connects to every other host: it listens on its own address, connects to the lower-numbered hosts and
+      * accepts the higher-numbered ones, so starting all of them at about the same time is enough.
+      * @param host This process's index into addresses.
+      * @param addresses "name:port" of every host, in host order; the same list everywhere.
+      * @param philosopher_begin [host] = its first philosopher, with one extra entry closing the last host.
+      * Connections that do not open with a valid hello from a host still expected are closed and ignored.
+      * @throws std::runtime_error if a host cannot be reached, or has not connected, within CONNECT_TIMEOUT.
+      */
+    TcpTransport(int host, const std::vector<std::string> &addresses, std::vector<int> philosopher_begin)
+        : host(host), philosopher_begin(std::move(philosopher_begin)), peers(addresses.size()) {
+        const int listener = net::listenOn(addresses[host]);
+        const auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+        try {
+            for (int peer = 0; peer < host; ++peer) {
+                peers[peer].socket = net::connectTo(addresses[peer], deadline);
+                setNoDelay(peers[peer].socket);
+                const uint32_t hello = host;
+                net::writeAll(peers[peer].socket, &hello, sizeof(hello));
+            }
+            for (size_t accepted = host + 1; accepted < addresses.size();) {
+                if (!net::waitReadable(listener, deadline)) {
+                    throw std::runtime_error("timed out waiting for the other hosts on " + addresses[host]);
+                }
+                const int socket = accept(listener, nullptr, nullptr);
+                if (socket < 0) {
+                    continue;
+                }
+                uint32_t hello = 0;
+                if (!net::waitReadable(socket, deadline) || !net::readAll(socket, &hello, sizeof(hello)) ||
+                    hello <= static_cast<uint32_t>(host) || hello >= addresses.size() || peers[hello].socket >= 0) {
+                    close(socket); // A stray connection, not one of the hosts still expected
+                    continue;
+                }
+                setNoDelay(socket);
+                peers[hello].socket = socket;
+                ++accepted;
+            }
+        } catch (...) {
+            close(listener);
+            closeAll();
+            throw;
+        }
+        close(listener);
+    }
+
+    ~TcpTransport() {
+        {
+            std::unique_lock lock(mtx);
+            stopping = true;
+        }
+        pending_cv.notify_all();
+        if (flusher.joinable()) {
+            flusher.join();
+        }
+        for (Peer &peer: peers) {
+            if (peer.socket >= 0) {
+                shutdown(peer.socket, SHUT_RDWR);
+            }
+        }
+        for (Peer &peer: peers) {
+            if (peer.reader.joinable()) {
+                peer.reader.join();
+            }
+        }
+        closeAll();
+    }
+
+    /**
+      * Starts the flusher and the readers.
+      * @param on_arrival Called from the reader threads with every envelope that arrives. Returning false rejects
+      *                   the envelope, and the peer that sent it is dropped.
+      */
+    void start(std::function<bool(const Envelope &)> on_arrival) {
+        deliver = std::move(on_arrival);
+        flusher = std::thread(&TcpTransport::flushLoop, this);
+        for (Peer &peer: peers) {
+            if (peer.socket >= 0) {
+                peer.reader = std::thread(&TcpTransport::readLoop, this, std::ref(peer));
+            }
+        }
+    }
+
+    // Queues an envelope for the host running its receiver
+    void send(const Envelope &envelope) {
+        const int peer = static_cast<int>(std::ranges::upper_bound(philosopher_begin, envelope.receiver) -
+                                          philosopher_begin.begin()) - 1;
+        assert(peer != host && peer >= 0 && peer < static_cast<int>(peers.size()));
+        size_t queued;
+        {
+            std::unique_lock lock(mtx);
+            peers[peer].batch.push_back(envelope);
+            queued = ++pending;
+        }
+        if (queued == 1 || queued == MAX_BATCH) {
+            pending_cv.notify_one();
+        }
+    }
+
+    // Envelopes written so far, and the frames they went out in
+    uint64_t getEnvelopesSent() const {
+        return envelopes_sent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getFramesSent() const {
+        return frames_sent.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(30);
+
+    struct Peer {
+        int socket = -1;
+        std::vector<Envelope> batch; // Guarded by mtx
+        std::thread reader;
+    };
+
+    int host;
+    std::vector<int> philosopher_begin;
+    std::vector<Peer> peers; // [host], this host's own entry unused
+    std::function<bool(const Envelope &)> deliver;
+    std::mutex mtx; // Guards the batches, pending and stopping
+    std::condition_variable pending_cv;
+    size_t pending = 0; // Envelopes in all batches
+    bool stopping = false;
+    std::thread flusher;
+    std::atomic<uint64_t> envelopes_sent = 0;
+    std::atomic<uint64_t> frames_sent = 0;
+
+    void flushLoop() {
+        std::vector<Envelope> outgoing;
+        std::vector<char> frame;
+        std::unique_lock lock(mtx);
+        while (true) {
+            pending_cv.wait(lock, [this] { return pending > 0 || stopping; });
+            if (pending == 0) {
+                return;
+            }
+            // Give a burst a moment to fill the batches, unless one is already big enough
+            pending_cv.wait_for(lock, LINGER, [this] { return pending >= MAX_BATCH || stopping; });
+            for (Peer &peer: peers) {
+                if (peer.batch.empty()) {
+                    continue;
+                }
+                outgoing.swap(peer.batch);
+                pending -= outgoing.size();
+                lock.unlock();
+                // Readers reject frames longer than MAX_BATCH, so a batch that grew past it goes out in several
+                for (size_t offset = 0; offset < outgoing.size(); offset += MAX_BATCH) {
+                    const auto count = static_cast<uint32_t>(std::min(MAX_BATCH, outgoing.size() - offset));
+                    frame.resize(sizeof(count) + count * sizeof(Envelope));
+                    std::memcpy(frame.data(), &count, sizeof(count));
+                    std::memcpy(frame.data() + sizeof(count), outgoing.data() + offset, count * sizeof(Envelope));
+                    // A peer that already hung up simply misses the rest of the run
+                    if (net::writeAll(peer.socket, frame.data(), frame.size())) {
+                        envelopes_sent.fetch_add(count, std::memory_order_relaxed);
+                        frames_sent.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                outgoing.clear();
+                lock.lock();
+            }
+        }
+    }
+
+    // Delivers every frame the peer sends until it hangs up, or until a frame shows it cannot be trusted
+    void readLoop(Peer &peer) {
+        std::vector<Envelope> incoming;
+        incoming.reserve(MAX_BATCH);
+        uint32_t count = 0;
+        while (net::readAll(peer.socket, &count, sizeof(count))) {
+            if (count > MAX_BATCH) {
+                return drop(peer, "a frame of " + std::to_string(count) + " envelopes");
+            }
+            incoming.resize(count);
+            if (!net::readAll(peer.socket, incoming.data(), count * sizeof(Envelope))) {
+                return;
+            }
+            for (const Envelope &envelope: incoming) {
+                if (!deliver(envelope)) {
+                    return drop(peer, "an envelope for philosopher " + std::to_string(envelope.receiver) +
+                                      " and bottle " + std::to_string(envelope.bottle));
+                }
+            }
+        }
+    }
+
+    // Stops listening to a peer that sent garbage; the rest of the run goes on without what it would have sent
+    void drop(Peer &peer, const std::string &what) {
+        const auto index = static_cast<int>(&peer - peers.data());
+        std::cerr << "host " << index << " sent " << what << " that this host cannot accept; dropping it\n";
+        shutdown(peer.socket, SHUT_RDWR);
+    }
+
+    void closeAll() {
+        for (Peer &peer: peers) {
+            if (peer.socket >= 0) {
+                close(std::exchange(peer.socket, -1));
+            }
+        }
+    }
+
+    // Batching already coalesces small writes; Nagle would only add a round trip on top
+    static void setNoDelay(int socket) {
+        const int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+};
+
+/*
+ * xoshiro256** by Blackman and Vigna: 32 bytes of state, a handful of shifts and xors per draw, and no shared
+ * state, so every philosopher owns one and draws without touching a lock. jump() advances by 2^128 draws, which
+ * splits one seed into as many non-overlapping streams as a run could ever need. Satisfies
+ * UniformRandomBitGenerator, so it also works with the <random> distributions and algorithms.
+ */
+class Xoshiro256 {
+public:
+    using result_type = uint64_t;
+
+    // Expands seed into the full state with splitmix64, as the authors recommend
+    explicit Xoshiro256(uint64_t seed = 0) {
+        for (uint64_t &word: state) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t mixed = seed;
+            mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9;
+            mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111eb;
+            word = mixed ^ (mixed >> 31);
+        }
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return UINT64_MAX;
+    }
+
+    result_type operator()() {
+        const uint64_t result = std::rotl(state[1] * 5, 7) * 9;
+        const uint64_t shifted = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= shifted;
+        state[3] = std::rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, bound) by Lemire's multiply-shift; the bias is below 2^-32 for any bound used here
+    uint32_t below(uint32_t bound) {
+        return static_cast<uint32_t>(((*this)() >> 32) * bound >> 32);
+    }
+
+    // Uniform in (0, 1]
+    double unit() {
+        return (((*this)() >> 11) + 1) * 0x1.0p-53;
+    }
+
+    // Advances the state as if by 2^128 draws
+    void jump() {
+        static constexpr uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+        uint64_t jumped[4] = {};
+        for (uint64_t polynomial: JUMP) {
+            for (int bit = 0; bit < 64; ++bit) {
+                if (polynomial & uint64_t{1} << bit) {
+                    for (int i = 0; i < 4; ++i) {
+                        jumped[i] ^= state[i];
+                    }
+                }
+                (*this)();
+            }
+        }
+        std::copy(std::begin(jumped), std::end(jumped), state);
+    }
+
+private:
+    uint64_t state[4];
+};
+
+// How long a philosopher spends on one think or drink
+struct Delay {
+    enum Kind {
+        UNIFORM, // a whole number of ms in [min_ms, max_ms)
+        EXPONENTIAL, // exponentially distributed around mean_ms
+        FIXED // always mean_ms
+    };
+
+    Kind kind = UNIFORM;
+    int min_ms = 500;
+    int max_ms = 1500;
+    int mean_ms = 1000;
+
+    /**
+      * Parses uniform:MIN:MAX, exp:MEAN or fixed:MS, all in milliseconds.
+      * @throws std::invalid_argument if the spec is malformed.
+      */
+    static Delay parse(std::string_view spec) {
+        const auto number = [&](std::string_view text) {
+            int value = 0;
+            const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec != std::errc() || end != text.data() + text.size() || value < 0) {
+                throw std::invalid_argument("bad delay: " + std::string(spec));
+            }
+            return value;
+        };
+        Delay delay;
+        if (spec.starts_with("uniform:") && spec.find(':', 8) != std::string_view::npos) {
+            const size_t colon = spec.find(':', 8);
+            delay.kind = UNIFORM;
+            delay.min_ms = number(spec.substr(8, colon - 8));
+            delay.max_ms = number(spec.substr(colon + 1));
+            if (delay.max_ms <= delay.min_ms) {
+                throw std::invalid_argument("bad delay: " + std::string(spec));
+            }
+        } else if (spec.starts_with("exp:")) {
+            delay.kind = EXPONENTIAL;
+            delay.mean_ms = number(spec.substr(4));
+        } else if (spec.starts_with("fixed:")) {
+            delay.kind = FIXED;
+            delay.mean_ms = number(spec.substr(6));
+        } else {
+            throw std::invalid_argument("bad delay: " + std::string(spec));
+        }
+        return delay;
+    }
+
+    std::string toString() const {
+        switch (kind) {
+            case UNIFORM: return "uniform:" + std::to_string(min_ms) + ":" + std::to_string(max_ms);
+            case EXPONENTIAL: return "exp:" + std::to_string(mean_ms);
+            default: return "fixed:" + std::to_string(mean_ms);
+        }
+    }
+
+    // Whether every sample is 0 ms
+    bool alwaysZero() const {
+        return kind == UNIFORM ? max_ms <= 1 : mean_ms == 0;
+    }
+
+    // Draws one delay from the caller's stream
+    std::chrono::milliseconds sample(Xoshiro256 &random) const {
+        switch (kind) {
+            case UNIFORM:
+                return std::chrono::milliseconds(min_ms + random.below(max_ms - min_ms));
+            case EXPONENTIAL:
+                return std::chrono::milliseconds(static_cast<int64_t>(-mean_ms * std::log(random.unit())));
+            default:
+                return std::chrono::milliseconds(mean_ms);
+        }
+    }
+};
+
+// Think and drink delays shared by every philosopher of a run; the defaults are the original 0.5-1.5 s
+struct Schedule {
+    Delay think;
+    Delay drink;
+};
+
+/*
+ * The part of a philosopher that other threads read while it runs, padded to a cache line of its own.
+ * Drivers keep these in one contiguous array, apart from the philosophers' private state, so a philosopher updating
+ * its counters never invalidates the line a neighbour is writing, and a reader sweeping the array touches nothing else.
+ * Every field has a single writer, the thread currently running the philosopher. Updates that change several fields
+ * at once are bracketed by a seqlock, so read() returns the fields of one moment without ever blocking the writer.
+ */
+struct alignas(64) PhilosopherStatus {
+    std::atomic<State> state = TRANQUIL;
+    std::atomic<uint64_t> held = 0; // Bit i set while it holds its i-th adjacent bottle; the first 64 only
+    std::atomic<uint64_t> drinks = 0; // Drinks finished
+    std::atomic<uint64_t> transitions = 0; // Becoming thirsty, starting to drink and going back to TRANQUIL
+    std::atomic<uint32_t> sequence = 0; // Odd while an update is under way
+
+    // The fields as of one moment
+    struct Reading {
+        State state;
+        uint64_t held;
+        uint64_t drinks;
+        uint64_t transitions;
+    };
+
+    // Single-writer increment: no locked read-modify-write needed
+    static void bump(std::atomic<uint64_t> &counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Bracket a multi-field update on the writer's side
+    void beginUpdate() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endUpdate() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Lock-free consistent read from any thread; retries only while it overlaps an update
+    Reading read() const {
+        while (true) {
+            const uint32_t before = sequence.load(std::memory_order_acquire);
+            const Reading reading{state.load(std::memory_order_relaxed), held.load(std::memory_order_relaxed),
+                                  drinks.load(std::memory_order_relaxed), transitions.load(std::memory_order_relaxed)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before % 2 == 0 && sequence.load(std::memory_order_relaxed) == before) {
+                return reading;
+            }
+        }
+    }
+
+    // Drinks finished so far, per philosopher
+    static std::vector<uint64_t> drinksOf(std::span<const PhilosopherStatus> statuses) {
+        std::vector<uint64_t> drinks;
+        drinks.reserve(statuses.size());
+        for (const auto &status: statuses) {
+            drinks.push_back(status.drinks.load(std::memory_order_relaxed));
+        }
+        return drinks;
+    }
+
+    // State changes so far, summed over every philosopher
+    static uint64_t transitionsOf(std::span<const PhilosopherStatus> statuses) {
+        uint64_t total = 0;
+        for (const auto &status: statuses) {
+            total += status.transitions.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// Class representing a philosopher in the simulation
+class alignas(64) Philosopher {
+public:
+    /**
+      * Constructor to initialize a philosopher.
+      * @param id The unique ID of the philosopher.
+      * @param bottle The engine arbitrating the bottles; must outlive the philosopher.
+      * @param graph The topology it sits on; must outlive the philosopher.
+      * @param status Where it publishes its state and counters; must outlive the philosopher.
+      * @param schedule How long it thinks and drinks.
+      * @param random The philosopher's own random stream, used for every random decision it makes.
+      */
+    Philosopher(int id, BottleEngine &bottle, const Graph &graph, PhilosopherStatus &status, Schedule schedule = {},
+                Xoshiro256 random = Xoshiro256())
+        : id(id), bottles(bottle), graph(graph), status(status), schedule(schedule), random(random) {
+        required_bottles.reserve(MAX_REQUIRED_BOTTLES);
+        setState(TRANQUIL);
+    }
+
+    /**
+      * The main loop for the philosopher's behavior.
+      * The philosopher alternates between thinking, becoming thirsty, acquiring bottles, drinking, and releasing bottles.
+      * @param stop Ends the loop when requested: a think or drink is cut short, a wait for bottles is given up, and
+      *             the philosopher returns TRANQUIL with nothing held.
+      */
+    void run(std::stop_token stop = {}) {
+        while (!stop.stop_requested()) {
+            bottles.idle(id, startThinking(), stop);
+            if (stop.stop_requested()) {
+                break;
+            }
+            finishThinking();
+            becomeThirsty();
+            if (!requestBottles(stop)) {
+                releaseBottles();
+                break;
+            }
+            bottles.idle(id, startDrinking(), stop);
+            finishDrinking();
+            releaseBottles();
+        }
+    }
+
+    State getState() const {
+        return status.state.load(std::memory_order_relaxed);
+    }
+
+    void publicBecomeThirsty() {
+        becomeThirsty();
+    }
+
+    /*
+     * The steps run() is made of, for drivers that schedule philosophers themselves instead of giving each a thread.
+     * A driver calls them in the same order, waiting out the returned durations and getting the bottles of
+     * getRequiredBottles() from the engine between becomeThirsty() and onBottlesAcquired().
+     */
+
+    // Enters TRANQUIL and returns how long to think
+    std::chrono::milliseconds startThinking() {
+        setState(TRANQUIL);
+        StateLogger::log(id, TRANQUIL, STARTED_THINKING);
+        return schedule.think.sample(random);
+    }
+
+    void finishThinking() {
+        StateLogger::log(id, TRANQUIL, FINISHED_THINKING);
+    }
+
+    /**
+     * Transitions the philosopher to the THIRSTY state and determines the bottles needed.
+     */
+    void becomeThirsty() {
+        status.beginUpdate();
+        setState(THIRSTY);
+        PhilosopherStatus::bump(status.transitions);
+        status.endUpdate();
+
+        // Get available bottles from the graph
+        std::span<const int> adjacent_bottles = graph.getAdjacentBottles(id);
+        const auto degree = static_cast<uint32_t>(adjacent_bottles.size());
+
+        // Randomly select 1 or 2 bottles to simulate `philosopher may need different subsets of bottles
+        const uint32_t limit = std::min<uint32_t>(random.below(MAX_REQUIRED_BOTTLES) + 1, degree);
+        required_bottles.clear();
+        required_mask = 0;
+
+        /*
+         * Random selection of bottles: the first steps of a Fisher-Yates shuffle of the positions in the adjacency,
+         * step i swapping position i with a random later one. Only the positions swapped so far differ from the
+         * identity, so they are all that is kept, latest first, instead of shuffling an array of every position.
+         */
+        std::pair<uint32_t, uint32_t> swapped[MAX_REQUIRED_BOTTLES]; // (position, index now there)
+        const auto indexAt = [&](uint32_t position, uint32_t steps) {
+            for (uint32_t k = steps; k-- > 0;) {
+                if (swapped[k].first == position) {
+                    return swapped[k].second;
+                }
+            }
+            return position;
+        };
+        for (uint32_t i = 0; i < limit; ++i) {
+            const uint32_t position = i + random.below(degree - i);
+            const uint32_t index = indexAt(position, i);
+            swapped[i] = {position, indexAt(i, i)};
+            required_bottles.push_back(adjacent_bottles[index]);
+            if (index < 64) {
+                required_mask |= uint64_t{1} << index;
+            }
+        }
+
+        thirsty_since_ns = StateLogger::now();
+        StateLogger::log(id, THIRSTY, NEEDS_BOTTLES, required_bottles);
+    }
+
+    // The bottles chosen by the last becomeThirsty()
+    const std::vector<int> &getRequiredBottles() const {
+        return required_bottles;
+    }
+
+    /**
+      * Called once the engine has handed over the required bottles.
+      * @param retries Failed attempts the engine reported for this acquisition.
+      */
+    void onBottlesAcquired(int retries = 0) {
+        Metrics::recordAcquisition(StateLogger::now() - thirsty_since_ns, retries);
+        status.beginUpdate();
+        status.held.store(required_mask, std::memory_order_relaxed);
+        setState(DRINKING);
+        PhilosopherStatus::bump(status.transitions);
+        status.endUpdate();
+        StateLogger::log(id, DRINKING, ACQUIRED_BOTTLES);
+    }
+
+    // Returns how long to drink
+    std::chrono::milliseconds startDrinking() {
+        StateLogger::log(id, DRINKING, STARTED_DRINKING);
+        return schedule.drink.sample(random);
+    }
+
+    void finishDrinking() {
+        PhilosopherStatus::bump(status.drinks);
+        StateLogger::log(id, DRINKING, FINISHED_DRINKING);
+    }
+
+    void releaseBottles() {
+        bottles.releaseBottles(id, required_bottles);
+        status.beginUpdate();
+        status.held.store(0, std::memory_order_relaxed);
+        setState(TRANQUIL);
+        PhilosopherStatus::bump(status.transitions);
+        status.endUpdate();
+        StateLogger::log(id, TRANQUIL, RELEASED_BOTTLES);
+    }
+
+private:
+    // The most bottles one drink needs; required_bottles is reserved for that many and never grows past it
+    static constexpr uint32_t MAX_REQUIRED_BOTTLES = 2;
+
+    // Only touched by the thread running the philosopher
+    int id; // Unique id for the philosopher
+    BottleEngine &bottles;
+    const Graph &graph;
+    PhilosopherStatus &status; // Current state of the philosopher, and its counters
+    std::vector<int> required_bottles;
+    uint64_t required_mask = 0; // required_bottles as positions in the adjacency, for status.held
+    int64_t thirsty_since_ns = 0; // StateLogger::now() at the last becomeThirsty()
+    Schedule schedule;
+    Xoshiro256 random;
+
+    void setState(State state) {
+        status.state.store(state, std::memory_order_relaxed);
+    }
+
+    /**
+     * Waits until the Bottles manager hands over the necessary bottles.
+     * @return False if stop was requested first.
+     */
+    bool requestBottles(std::stop_token stop) {
+        const auto retries = bottles.acquireBottlesBlocking(id, required_bottles, stop);
+        if (retries) {
+            onBottlesAcquired(*retries);
+        }
+        return retries.has_value();
+    }
+};
+
+/**
+ * Hashed timer wheel with one-millisecond slots, owned by a single thread.
+ * A timer sits in the slot of its due tick; delays longer than one turn of the wheel wait in their slot
+ * until the turn they are due in, so scheduling and firing are O(1) per timer.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimerWheel(Clock::time_point start) : start(start), slots(SLOTS) {
+    }
+
+    // Arms a timer for task, due no earlier than delay from the last advance()
+    void schedule(std::chrono::milliseconds delay, int task) {
+        const int64_t due_tick = current_tick + std::max<int64_t>(delay.count(), 1);
+        slots[due_tick & (SLOTS - 1)].push_back(Entry{due_tick, task});
+        ++pending;
+    }
+
+    /**
+      * Moves the wheel up to now, handing every task that has come due to fire.
+      * @param now The current time.
+      * @param fire Called with each due task.
+      */
+    template<typename Fire>
+    void advance(Clock::time_point now, Fire &&fire) {
+        const int64_t target_tick = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        // Past a full turn every slot has been visited once, so the rest of the lag can be skipped
+        const int64_t first_tick = std::max(current_tick + 1, target_tick - SLOTS + 1);
+        for (int64_t tick = first_tick; tick <= target_tick && pending > 0; ++tick) {
+            auto &slot = slots[tick & (SLOTS - 1)];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].due_tick <= target_tick) {
+                    const int task = slot[i].task;
+                    slot[i] = slot.back();
+                    slot.pop_back();
+                    --pending;
+                    fire(task);
+                } else {
+                    ++i;
+                }
+            }
+        }
+        current_tick = std::max(current_tick, target_tick);
+    }
+
+    bool empty() const {
+        return pending == 0;
+    }
+
+private:
+    static constexpr int64_t SLOTS = 4096; // A power of two comfortably above the longest think/drink delay
+
+    struct Entry {
+        int64_t due_tick;
+        int task;
+    };
+
+    Clock::time_point start;
+    std::vector<std::vector<Entry> > slots;
+    int64_t current_tick = 0; // Milliseconds since start the wheel has been advanced to
+    size_t pending = 0;
+};
+
+/**
+ * Fixed set of worker threads running short, non-blocking tasks identified by an int.
+ * Each worker keeps its own deque, popping its newest task and stealing the oldest from the others when it runs dry,
+ * and its own TimerWheel for tasks that should run after a delay. Tasks never block a worker: anything that has to
+ * wait is either put on a timer with scheduleAfter or resubmitted by whoever ends the wait.
+ */
+class WorkStealingPool {
+public:
+    /**
+      * Starts the workers.
+      * @param number_of_workers How many threads to run, at least one.
+      * @param run_task Runs one task; called concurrently from all workers, never for the same task twice at once
+      *                 unless it was submitted twice.
+      * @param on_worker_start Called on each worker's own thread with its index before it runs any task.
+      */
+    WorkStealingPool(int number_of_workers, std::function<void(int)> run_task,
+                     std::function<void(int)> on_worker_start = {})
+        : run_task(std::move(run_task)), on_worker_start(std::move(on_worker_start)) {
+        const auto start = TimerWheel::Clock::now();
+        workers.reserve(number_of_workers);
+        for (int idx = 0; idx < number_of_workers; ++idx) {
+            workers.emplace_back(std::make_unique<Worker>(start));
+        }
+        for (int idx = 0; idx < number_of_workers; ++idx) {
+            workers[idx]->thread = std::thread(&WorkStealingPool::workerLoop, this, idx);
+        }
+    }
+
+    ~WorkStealingPool() {
+        stop();
+    }
+
+    // Queues task to run as soon as a worker is free; from a worker it goes on that worker's own deque
+    void submit(int task) {
+        submit(task, current_pool == this
+                         ? current_worker
+                         : static_cast<int>(next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()));
+    }
+
+    // Queues task on the deque of the given worker; idle workers may still steal it
+    void submit(int task, int worker_idx) {
+        Worker &worker = *workers[worker_idx];
+        {
+            std::unique_lock lock(worker.mtx);
+            worker.tasks.push_back(task);
+        }
+        if (sleeping.load(std::memory_order_acquire) > 0) {
+            idle_cv.notify_one();
+        }
+    }
+
+    // Runs task on this worker once delay has passed; only callable from a task running in this pool
+    void scheduleAfter(std::chrono::milliseconds delay, int task) {
+        assert(current_pool == this);
+        workers[current_worker]->timers.schedule(delay, task);
+    }
+
+    // Waits for the running tasks to finish and stops the workers; queued and timed tasks are dropped
+    void stop() {
+        if (stopping.exchange(true)) {
+            return;
+        }
+        idle_cv.notify_all();
+        for (auto &worker: workers) {
+            worker->thread.join();
+        }
+    }
+
+private:
+    static constexpr auto MAX_IDLE = std::chrono::milliseconds(10);
+
+    struct Worker {
+        explicit Worker(TimerWheel::Clock::time_point start) : timers(start) {
+        }
+
+        std::mutex mtx; // Guards tasks; held only to push or pop, never while running a task
+        std::deque<int> tasks;
+        TimerWheel timers; // Only touched by the worker's own thread
+        std::thread thread;
+    };
+
+    static inline thread_local WorkStealingPool *current_pool = nullptr;
+    static inline thread_local int current_worker = -1;
+
+    std::function<void(int)> run_task;
+    std::function<void(int)> on_worker_start;
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::atomic<size_t> next_worker = 0; // Round-robin target for tasks submitted from outside the pool
+    std::atomic<bool> stopping = false;
+    std::atomic<int> sleeping = 0;
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+
+    void workerLoop(int idx) {
+        current_pool = this;
+        current_worker = idx;
+        if (on_worker_start) {
+            on_worker_start(idx);
+        }
+        Worker &self = *workers[idx];
+        while (!stopping.load(std::memory_order_relaxed)) {
+            self.timers.advance(TimerWheel::Clock::now(), [&self](int task) {
+                std::unique_lock lock(self.mtx);
+                self.tasks.push_back(task);
+            });
+
+            std::optional<int> task = popOwn(self);
+            if (!task) {
+                task = steal(idx);
+            }
+            if (task) {
+                run_task(*task);
+                continue;
+            }
+
+            // Nothing runnable: sleep until the next timer could be due, or a submit wakes us
+            std::unique_lock lock(idle_mtx);
+            sleeping.fetch_add(1, std::memory_order_acq_rel);
+            idle_cv.wait_for(lock, self.timers.empty() ? MAX_IDLE : std::chrono::milliseconds(1));
+            sleeping.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        current_pool = nullptr;
+        current_worker = -1;
+    }
+
+    static std::optional<int> popOwn(Worker &worker) {
+        std::unique_lock lock(worker.mtx);
+        if (worker.tasks.empty()) {
+            return std::nullopt;
+        }
+        const int task = worker.tasks.back();
+        worker.tasks.pop_back();
+        return task;
+    }
+
+    std::optional<int> steal(int thief) {
+        for (size_t offset = 1; offset < workers.size(); ++offset) {
+            Worker &victim = *workers[(thief + offset) % workers.size()];
+            std::unique_lock lock(victim.mtx, std::try_to_lock);
+            if (lock.owns_lock() && !victim.tasks.empty()) {
+                const int task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+/**
+ * Runs the philosophers of a Bottles table as tasks on a WorkStealingPool instead of one thread each.
+ * Each philosopher is a small state machine over Philosopher's steps: thinking and drinking are timers on the
+ * pool, and a philosopher that cannot drink yet is queued on the table and resubmitted when its bottles are handed
+ * over, so no worker ever sleeps or blocks on behalf of a philosopher.
+ */
+class PooledPhilosophers {
+public:
+    /**
+      * Creates the philosophers and starts them on a pool of number_of_workers threads.
+      * @param graph The topology the philosophers sit on.
+      * @param table The Bottles table arbitrating their bottles.
+      * @param number_of_workers Worker threads in the pool.
+      * @param schedule How long the philosophers think and drink.
+      * @param seed Seed split into one random stream per philosopher.
+      * @param plan Partitions of graph to place the workers by, or null to let them run anywhere. Workers are split
+      *             evenly over the partitions and pinned to their node, and each philosopher starts on a worker of
+      *             its own partition.
+      */
+    PooledPhilosophers(const std::shared_ptr<Graph> &graph, const std::shared_ptr<Bottles> &table,
+                       int number_of_workers, const Schedule &schedule = {}, uint64_t seed = 0,
+                       const placement::Plan *plan = nullptr)
+        : graph(graph), table(table), statuses(graph->getNumberOfVertices()) {
+        const int number_of_philosophers = graph->getNumberOfVertices();
+        if (plan) {
+            plan->bindByPhilosopher(std::span(statuses));
+        }
+        tasks.reserve(number_of_philosophers);
+        Xoshiro256 streams(seed);
+        for (int idx = 0; idx < number_of_philosophers; ++idx) {
+            tasks.emplace_back(std::make_unique<Task>(idx, *table, *graph, statuses[idx], schedule, streams,
+                                                      [this, idx] { arriveAtHandover(idx); }));
+            streams.jump();
+        }
+        if (!plan) {
+            pool.emplace(number_of_workers, [this](int idx) { step(idx); });
+            for (int idx = 0; idx < number_of_philosophers; ++idx) {
+                pool->submit(idx);
+            }
+            return;
+        }
+
+        const int64_t parts = plan->getNumberOfPartitions();
+        pool.emplace(number_of_workers, [this](int idx) { step(idx); }, [plan, parts, number_of_workers](int worker) {
+            placement::pinCurrentThread(plan->nodes[worker * parts / number_of_workers].cpus);
+        });
+        for (int idx = 0; idx < number_of_philosophers; ++idx) {
+            pool->submit(idx, static_cast<int>(plan->partitionOf(idx) * number_of_workers / parts));
+        }
+    }
+
+    /**
+      * Stops the pool and winds every philosopher down the way a stopped thread of the threaded driver does: a drink
+      * in progress is finished, queued waiters give up and leave the table's queues, and everyone ends TRANQUIL with
+      * nothing held, so the table keeps no pointers to the tasks once they are destroyed.
+      */
+    void stop() {
+        pool->stop();
+        // Every wait is given up before anyone leaves the queues or releases, so no grant can reach a task the
+        // pool will never run again
+        for (auto &task: tasks) {
+            if (task->phase == WAITING) {
+                table->cancelWait(task->waiter);
+            }
+        }
+        for (auto &task: tasks) {
+            switch (task->phase) {
+                case WAITING:
+                    table->leaveQueues(task->waiter);
+                    task->philosopher.releaseBottles();
+                    break;
+                case DRINKING:
+                    task->philosopher.finishDrinking();
+                    task->philosopher.releaseBottles();
+                    break;
+                default:
+                    break;
+            }
+            task->phase = STARTING;
+        }
+    }
+
+    ~PooledPhilosophers() {
+        stop();
+    }
+
+    // Every philosopher's published state and counters, indexed by philosopher
+    std::span<const PhilosopherStatus> getStatuses() const {
+        return statuses;
+    }
+
+private:
+    enum Phase : uint8_t {
+        STARTING, // Not run yet
+        THINKING, // On a think timer
+        WAITING, // Queued on the table for its bottles
+        DRINKING // On a drink timer
+    };
+
+    struct Task {
+        Task(int id, Bottles &table, const Graph &graph, PhilosopherStatus &status, const Schedule &schedule,
+             const Xoshiro256 &random, std::function<void()> on_granted)
+            : philosopher(id, table, graph, status, schedule, random), waiter(id, std::move(on_granted)) {
+        }
+
+        Philosopher philosopher;
+        Bottles::Waiter waiter;
+        Phase phase = STARTING; // Only touched by whichever worker is running the task
+        // The queueing call returning and the grant both arrive here; the second one resubmits the task
+        std::atomic<int> handover_arrivals = 0;
+    };
+
+    std::shared_ptr<Graph> graph;
+    std::shared_ptr<Bottles> table;
+    std::vector<PhilosopherStatus> statuses; // [philosopher]
+    std::vector<std::unique_ptr<Task> > tasks;
+    std::optional<WorkStealingPool> pool; // Last, so the workers stop before the tasks they run are destroyed
+
+    void step(int idx) {
+        Task &task = *tasks[idx];
+        Philosopher &philosopher = task.philosopher;
+        switch (task.phase) {
+            case STARTING:
+                think(task, idx);
+                break;
+            case THINKING:
+                philosopher.finishThinking();
+                philosopher.becomeThirsty();
+                task.phase = WAITING;
+                task.handover_arrivals.store(0, std::memory_order_relaxed);
+                if (table->acquireBottlesOrQueue(task.waiter, philosopher.getRequiredBottles())) {
+                    drink(task, idx);
+                } else {
+                    arriveAtHandover(idx);
+                }
+                break;
+            case WAITING:
+                table->leaveQueues(task.waiter);
+                drink(task, idx, task.waiter.getRetries());
+                break;
+            case DRINKING:
+                philosopher.finishDrinking();
+                philosopher.releaseBottles();
+                think(task, idx);
+                break;
+        }
+    }
+
+    void think(Task &task, int idx) {
+        task.phase = THINKING;
+        pool->scheduleAfter(task.philosopher.startThinking(), idx);
+    }
+
+    void drink(Task &task, int idx, int retries = 0) {
+        task.philosopher.onBottlesAcquired(retries);
+        task.phase = DRINKING;
+        pool->scheduleAfter(task.philosopher.startDrinking(), idx);
+    }
+
+    // The grant can fire on another worker before acquireBottlesOrQueue has returned; resume only after both
+    void arriveAtHandover(int idx) {
+        if (tasks[idx]->handover_arrivals.fetch_add(1, std::memory_order_acq_rel) == 1) {
+            pool->submit(idx);
+        }
+    }
+};
+
+/**
+ * Runs the philosophers of a Bottles table against a simulated clock instead of one thread and real sleeps each.
+ * Every think, drink and handover is an event in a time-ordered queue and the clock jumps straight to the next
+ * one, so a run covers simulated minutes in a fraction of that and scales to graphs far larger than the thread
+ * limit. Philosophers that cannot drink yet are queued on the table through Bottles::Waiter and get a GRANTED
+ * event when a release hands their set over. Single threaded: the table is only touched from run().
+ */
+class DiscreteEventSimulation {
+public:
+    struct Summary {
+        int64_t simulated_ns = 0; // Simulated time covered
+        uint64_t events = 0; // Events processed
+        uint64_t drinks = 0; // Completed drinking sessions
+        uint64_t transitions = 0; // State changes, as counted by PhilosopherStatus
+    };
+
+    /**
+      * @param graph The topology the philosophers sit on.
+      * @param table The Bottles table arbitrating their bottles; not shared with any running thread.
+      * @param delays How long the philosophers think and drink.
+      * @param seed Seed split into one random stream per philosopher; the same seed replays the same run.
+      */
+    DiscreteEventSimulation(const std::shared_ptr<Graph> &graph, const std::shared_ptr<Bottles> &table,
+                            const Schedule &delays = {}, uint64_t seed = 0)
+        : graph(graph), table(table), statuses(graph->getNumberOfVertices()) {
+        const int number_of_philosophers = graph->getNumberOfVertices();
+        philosophers.reserve(number_of_philosophers);
+        waiters.reserve(number_of_philosophers);
+        Xoshiro256 streams(seed);
+        for (int idx = 0; idx < number_of_philosophers; ++idx) {
+            philosophers.emplace_back(std::make_unique<Philosopher>(idx, *table, *graph, statuses[idx], delays, streams));
+            streams.jump();
+            // Runs inside a release, with the table's queues locked, so it only schedules the handover
+            waiters.emplace_back(std::make_unique<Bottles::Waiter>(idx, [this, idx] { schedule(now_ns, idx, GRANTED); }));
+        }
+    }
+
+    /**
+      * Simulates the table from the start for the given span of simulated time, or until enough has happened.
+      * Log records, if enabled, are stamped with simulated time.
+      * @param duration How much simulated time to cover.
+      * @param max_transitions Stops after the event that brings the state changes up to this many.
+      */
+    Summary run(std::chrono::nanoseconds duration, uint64_t max_transitions = UINT64_MAX) {
+        StateLogger::useVirtualClock(&now_ns);
+        for (int idx = 0; idx < static_cast<int>(philosophers.size()); ++idx) {
+            schedule(now_ns + nanoseconds(philosophers[idx]->startThinking()), idx, THINK_DONE);
+        }
+
+        Summary summary;
+        const int64_t end_ns = now_ns + duration.count();
+        while (!events.empty() && events.top().time_ns <= end_ns && summary.transitions < max_transitions) {
+            const Event event = events.top();
+            events.pop();
+            now_ns = event.time_ns;
+            ++summary.events;
+
+            Philosopher &philosopher = *philosophers[event.philosopher_id];
+            switch (event.kind) {
+                case THINK_DONE:
+                    philosopher.finishThinking();
+                    philosopher.becomeThirsty();
+                    ++summary.transitions;
+                    if (table->acquireBottlesOrQueue(*waiters[event.philosopher_id], philosopher.getRequiredBottles())) {
+                        startDrinking(event.philosopher_id);
+                        ++summary.transitions;
+                    }
+                    break;
+                case GRANTED:
+                    table->leaveQueues(*waiters[event.philosopher_id]);
+                    startDrinking(event.philosopher_id, waiters[event.philosopher_id]->getRetries());
+                    ++summary.transitions;
+                    break;
+                case DRINK_DONE:
+                    philosopher.finishDrinking();
+                    philosopher.releaseBottles();
+                    ++summary.drinks;
+                    ++summary.transitions;
+                    schedule(now_ns + nanoseconds(philosopher.startThinking()), event.philosopher_id, THINK_DONE);
+                    break;
+            }
+        }
+        if (summary.transitions < max_transitions) {
+            now_ns = end_ns;
+        }
+        summary.simulated_ns = now_ns;
+        StateLogger::useVirtualClock(nullptr);
+        return summary;
+    }
+
+    // Every philosopher's published state and counters, indexed by philosopher
+    std::span<const PhilosopherStatus> getStatuses() const {
+        return statuses;
+    }
+
+private:
+    enum EventKind : uint8_t {
+        THINK_DONE, // Finished thinking, becomes thirsty
+        GRANTED, // Was queued and has just been handed its bottles
+        DRINK_DONE // Finished drinking, releases its bottles
+    };
+
+    struct Event {
+        int64_t time_ns;
+        uint64_t sequence; // Breaks ties in scheduling order so runs are repeatable
+        int philosopher_id;
+        EventKind kind;
+
+        // Reversed so the priority queue pops the earliest event first
+        bool operator<(const Event &other) const {
+            return time_ns != other.time_ns ? time_ns > other.time_ns : sequence > other.sequence;
+        }
+    };
+
+    std::shared_ptr<Graph> graph;
+    std::shared_ptr<Bottles> table;
+    std::vector<PhilosopherStatus> statuses; // [philosopher]
+    std::vector<std::unique_ptr<Philosopher> > philosophers;
+    std::vector<std::unique_ptr<Bottles::Waiter> > waiters; // Stable addresses, the table keeps pointers to them
+    std::priority_queue<Event> events;
+    int64_t now_ns = 0; // Simulated nanoseconds since the start of the run
+    uint64_t next_sequence = 0;
+
+    static int64_t nanoseconds(std::chrono::milliseconds duration) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    void schedule(int64_t time_ns, int philosopher_id, EventKind kind) {
+        events.push(Event{time_ns, next_sequence++, philosopher_id, kind});
+    }
+
+    void startDrinking(int philosopher_id, int retries = 0) {
+        Philosopher &philosopher = *philosophers[philosopher_id];
+        philosopher.onBottlesAcquired(retries);
+        schedule(now_ns + nanoseconds(philosopher.startDrinking()), philosopher_id, DRINK_DONE);
+    }
+};
+
+// Text as a JSON string literal, quotes included, with quotes, backslashes and control characters escaped
+std::string quoteJson(std::string_view text) {
+    std::string out = "\"";
+    for (const char c: text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+/**
+ * Answers HTTP GET requests with a JSON snapshot of a running simulation, over TCP or a Unix domain socket.
+ * / returns every philosopher's state, held mask and counters, the owner of every table bottle and the metrics so far;
+ * /metrics returns the metrics alone. Philosophers are read through their seqlocks and bottles through their atomic
+ * owners, so a scrape never takes a lock the simulation uses and needs no logging. Each philosopher and each bottle
+ * is consistent on its own; the snapshot as a whole is not one global instant.
+ * One thread serves one connection at a time and closes it after the response.
+ */
+class StatusServer {
+public:
+    /**
+      * Starts serving.
+      * @param address "unix:PATH", "NAME:PORT" or just a port to listen on every interface.
+      * @throws std::runtime_error if it cannot listen there.
+      */
+    explicit StatusServer(const std::string &address) {
+        if (address.starts_with("unix:")) {
+            unix_path = address.substr(5);
+            listener = net::listenOnUnix(unix_path);
+        } else {
+            listener = net::listenOn(address.find(':') == std::string::npos ? ":" + address : address);
+        }
+        server = std::thread(&StatusServer::serveLoop, this);
+    }
+
+    ~StatusServer() {
+        shutdown(listener, SHUT_RDWR);
+        server.join();
+        close(listener);
+        if (!unix_path.empty()) {
+            unlink(unix_path.c_str());
+        }
+    }
+
+    /**
+      * Publishes a run until conceal(); both sides must outlive that.
+      * @param statuses The philosophers to report.
+      * @param first_id Id of statuses[0].
+      * @param table The table whose owners to report, or null for engines without one.
+      */
+    void expose(std::span<const PhilosopherStatus> statuses, int first_id, const Bottles *table) {
+        std::unique_lock lock(mtx);
+        source = {statuses, first_id, table};
+    }
+
+    // Stops publishing the run, once any response in progress is written
+    void conceal() {
+        std::unique_lock lock(mtx);
+        source = {};
+    }
+
+    /**
+      * Renders the snapshot JSON of a run.
+      * @param statuses The philosophers to report.
+      * @param first_id Id of statuses[0].
+      * @param table The table whose owners to report, or null.
+      */
+    static std::string snapshot(std::span<const PhilosopherStatus> statuses, int first_id, const Bottles *table) {
+        std::string out = "{\"taken_at_ns\": " + std::to_string(StateLogger::now()) + ", \"philosophers\": [";
+        std::vector<uint64_t> drinks;
+        drinks.reserve(statuses.size());
+        for (size_t i = 0; i < statuses.size(); ++i) {
+            const PhilosopherStatus::Reading reading = statuses[i].read();
+            drinks.push_back(reading.drinks);
+            out += (i ? ", {\"id\": " : "{\"id\": ") + std::to_string(first_id + i) + ", \"state\": " +
+                    quoteJson(stateToString(reading.state)) + ", \"held\": " + std::to_string(reading.held) +
+                    ", \"drinks\": " + std::to_string(reading.drinks) + ", \"transitions\": " +
+                    std::to_string(reading.transitions) + "}";
+        }
+        out += "], \"bottles\": ";
+        std::vector<uint64_t> contention;
+        if (table) {
+            out += "[";
+            const std::vector<int> owners = table->getOwners();
+            for (size_t bottle = 0; bottle < owners.size(); ++bottle) {
+                out += (bottle ? ", " : "") + std::to_string(owners[bottle]);
+            }
+            out += "]";
+            contention = table->getContention();
+        } else {
+            out += "null";
+        }
+        out += ", \"metrics\": " + metricsJson(drinks, contention) + "}";
+        return out;
+    }
+
+    // Metrics gathered so far, as JSON
+    static std::string metricsJson(const std::vector<uint64_t> &drinks, const std::vector<uint64_t> &contention) {
+        const Metrics::Summary summary = Metrics::summarize(drinks, contention);
+        return "{\"acquisitions\": " + std::to_string(summary.acquisitions) +
+               ", \"wait_ns\": {\"p50\": " + std::to_string(summary.wait_p50_ns) +
+               ", \"p99\": " + std::to_string(summary.wait_p99_ns) +
+               ", \"p999\": " + std::to_string(summary.wait_p999_ns) +
+               ", \"max\": " + std::to_string(summary.wait_max_ns) + "}" +
+               ", \"retries\": {\"mean\": " + std::to_string(summary.retries_mean) +
+               ", \"p99\": " + std::to_string(summary.retries_p99) +
+               ", \"max\": " + std::to_string(summary.retries_max) + "}" +
+               ", \"drinks\": " + std::to_string(summary.drinks) +
+               ", \"jain_fairness\": " + std::to_string(summary.jain_fairness) + "}";
+    }
+
+private:
+    struct Source {
+        std::span<const PhilosopherStatus> statuses;
+        int first_id = 0;
+        const Bottles *table = nullptr;
+    };
+
+    int listener = -1;
+    std::string unix_path; // Removed again on shutdown
+    std::thread server;
+    std::mutex mtx; // Guards source; only taken by expose, conceal and the response being rendered
+    Source source;
+
+    void serveLoop() {
+        while (true) {
+            const int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return; // The listener was shut down
+            }
+            respond(connection);
+            close(connection);
+        }
+    }
+
+    void respond(int connection) {
+        // Only the request line matters; it has to arrive within the first read or two
+        timeval timeout{1, 0};
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n") == std::string::npos && request.size() < 8192) {
+            const ssize_t read = recv(connection, buffer, sizeof(buffer), 0);
+            if (read <= 0) {
+                break;
+            }
+            request.append(buffer, read);
+        }
+        const std::string_view line = std::string_view(request).substr(0, request.find("\r\n"));
+        const size_t path_begin = line.find(' ') + 1;
+        const std::string_view path = path_begin == 0
+                                          ? std::string_view()
+                                          : line.substr(path_begin, line.find(' ', path_begin) - path_begin);
+
+        std::string status = "200 OK", body;
+        if (!line.starts_with("GET ")) {
+            status = "405 Method Not Allowed";
+        } else if (path == "/" || path == "/metrics") {
+            std::unique_lock lock(mtx);
+            if (path == "/") {
+                body = snapshot(source.statuses, source.first_id, source.table);
+            } else {
+                body = metricsJson(PhilosopherStatus::drinksOf(source.statuses),
+                                   source.table ? source.table->getContention() : std::vector<uint64_t>());
+            }
+        } else {
+            status = "404 Not Found";
+        }
+        const std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " +
+                                     std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        net::writeAll(connection, response.data(), response.size());
+    }
+};
+
+#ifdef COUNT_ALLOCATIONS
+/*
+ * Replacement global allocation functions that count the heap allocations made by each thread, so the tests can
+ * check that a steady-state philosopher cycle makes none. Per thread, so the logger thread's batches do not count.
+ * Only in test builds (-DCOUNT_ALLOCATIONS), which add that check to the alpha tests; other builds keep the
+ * library's allocator untouched.
+ */
+thread_local uint64_t heap_allocations = 0;
+
+// All kept out of line: once inlined, GCC sees malloc() paired with operator delete and warns of a mismatch
+__attribute__((noinline)) void *operator new(std::size_t size) {
+    ++heap_allocations;
+    if (void *memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new(std::size_t size, std::align_val_t alignment) {
+    ++heap_allocations;
+    const auto align = static_cast<std::size_t>(alignment);
+    // aligned_alloc wants a multiple of the alignment
+    if (void *memory = std::aligned_alloc(align, (size + align - 1) / align * align + (size ? 0 : align))) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+#endif // COUNT_ALLOCATIONS
+
+void alphaTests() {
+    std::cout << "\n================ ALPHA TESTS ================\n";
+
+    // Test 1: Graph Construction and Edge Addition
+    {
+        GraphBuilder builder(5);
+        builder.addEdge(0, 1, 0);
+        builder.addEdge(1, 2, 1);
+        Graph g = builder.build();
+
+        auto bottles = g.getAdjacentBottles(1);
+        assert(bottles.size() == 2);
+        assert(std::find(bottles.begin(), bottles.end(), 0) != bottles.end());
+        assert(std::find(bottles.begin(), bottles.end(), 1) != bottles.end());
+        StateLogger::flush();
+        std::cout << "Graph construction test passed\n";
+    }
+
+    // Test 1b: CSR rows are sorted by neighbor and a repeated edge keeps its last bottle
+    {
+        GraphBuilder builder(4);
+        builder.addEdge(3, 0, 7);
+        builder.addEdge(0, 1, 0);
+        builder.addEdge(1, 0, 2);
+        Graph g = builder.build();
+
+        assert(g.getNumberOfEdges() == 2 && g.getNumberOfBottles() == 8);
+        assert(std::ranges::equal(g.getNeighbors(0), std::vector<int>{1, 3}));
+        assert(std::ranges::equal(g.getAdjacentBottles(0), std::vector<int>{2, 7}));
+        assert(std::ranges::equal(g.getAdjacentBottles(1), std::vector<int>{2}));
+        assert(g.getAdjacentBottles(2).empty());
+        StateLogger::flush();
+        std::cout << "Graph CSR layout test passed\n";
+    }
+
+    // Test 1c: Topology generators
+    {
+        Graph torus = topology::fromSpec("torus:4x3", 1);
+        Graph regular = topology::fromSpec("regular:200:4", 7);
+        Graph power_law = topology::fromSpec("powerlaw:300:2", 7);
+        assert(topology::ring(5).getNumberOfEdges() == 5 && topology::grid(4, 3, false).getNumberOfEdges() == 17);
+        assert(torus.getNumberOfEdges() == 24 && torus.getNumberOfBottles() == 24);
+        for (int vertex = 0; vertex < torus.getNumberOfVertices(); ++vertex) {
+            assert(torus.getNeighbors(vertex).size() == 4);
+        }
+        int short_vertices = 0;
+        for (int vertex = 0; vertex < regular.getNumberOfVertices(); ++vertex) {
+            const auto neighbors = regular.getNeighbors(vertex);
+            assert(std::ranges::adjacent_find(neighbors) == neighbors.end());
+            assert(std::ranges::find(neighbors, vertex) == neighbors.end());
+            short_vertices += neighbors.size() != 4;
+        }
+        assert(short_vertices <= 4);
+        assert(power_law.getNumberOfEdges() == 1 + 298 * 2);
+        StateLogger::flush();
+        std::cout << "Topology generator test passed\n";
+    }
+
+    // Test 1d: Partitioning renumbers into contiguous philosopher and bottle ranges, each bottle with its first owner
+    {
+        Graph graph = topology::grid(6, 4, false);
+        const size_t edges = graph.getNumberOfEdges();
+        const std::vector<placement::Node> nodes = {{0, {0}}, {1, {0}}};
+        const placement::Plan plan = placement::partition(graph, 3, nodes);
+        assert(graph.getNumberOfEdges() == edges && graph.getNumberOfBottles() == static_cast<int>(edges));
+        assert(plan.getNumberOfPartitions() == 3 && plan.nodes[2].id == 0);
+        assert(plan.philosopher_begin == std::vector<int>({0, 8, 16, 24}));
+        assert(plan.bottle_begin.front() == 0 && plan.bottle_begin.back() == static_cast<int>(edges));
+        size_t cut = 0;
+        for (int philosopher = 0; philosopher < graph.getNumberOfVertices(); ++philosopher) {
+            const auto neighbors = graph.getNeighbors(philosopher);
+            for (size_t i = 0; i < neighbors.size(); ++i) {
+                const int owner = std::min(philosopher, neighbors[i]);
+                const int bottle = graph.getAdjacentBottles(philosopher)[i];
+                const int part = plan.partitionOf(owner);
+                assert(plan.bottle_begin[part] <= bottle && bottle < plan.bottle_begin[part + 1]);
+                cut += neighbors[i] > philosopher && plan.partitionOf(neighbors[i]) != plan.partitionOf(philosopher);
+            }
+        }
+        assert(cut == plan.cut_edges && cut < edges / 2);
+        StateLogger::flush();
+        std::cout << "Graph partition test passed\n";
+    }
+
+    // Test 2: Bottle Management, once per ownership policy
+    for (BottlePolicy policy: {GLOBAL_MUTEX, PER_BOTTLE_CAS, WORD_MASK}) {
+        Bottles bottles(3, policy);
+        std::vector<int> req_bottles = {0, 1};
+
+        // Test acquisition
+        assert(bottles.acquireBottles(0, req_bottles) == true);
+
+        // Test concurrent acquisition
+        std::vector<int> other_bottles = {1, 2};
+        assert(bottles.acquireBottles(1, other_bottles) == false);
+
+        // Test release
+        bottles.releaseBottles(0);
+        assert(bottles.acquireBottles(1, other_bottles) == true);
+        StateLogger::flush();
+        std::cout << "Bottle management test passed (" << policyToString(policy) << ")\n";
+
+    }
+
+    // Test 3: A failed lock-free claim rolls back only what it claimed
+    for (BottlePolicy policy: {PER_BOTTLE_CAS, WORD_MASK}) {
+        Bottles bottles(4, policy);
+        std::vector<int> held = {1};
+        std::vector<int> blocker = {3};
+        std::vector<int> wanted = {2, 1, 0, 3};
+        assert(bottles.acquireBottles(0, held) == true);
+        assert(bottles.acquireBottles(1, blocker) == true);
+        assert(bottles.acquireBottles(0, wanted) == false);
+
+        // Bottle 1 stays with P0, bottles 0 and 2 were handed back
+        std::vector<int> freed = {0, 2};
+        assert(bottles.acquireBottles(2, freed) == true);
+        assert(bottles.acquireBottles(2, held) == false);
+        StateLogger::flush();
+        std::cout << "Bottle rollback test passed (" << policyToString(policy) << ")\n";
+    }
+
+    // Test 3b: Word-mask claims that span several words roll back the words already claimed
+    {
+        Bottles bottles(130, WORD_MASK);
+        std::vector<int> blocker = {129};
+        std::vector<int> wanted = {129, 64, 0};
+        std::vector<int> freed = {0, 63, 64};
+        assert(bottles.acquireBottles(1, blocker) == true);
+        assert(bottles.acquireBottles(0, wanted) == false);
+        assert(bottles.acquireBottles(2, freed) == true);
+
+        bottles.releaseBottles(2, freed);
+        bottles.releaseBottles(1, blocker);
+        assert(bottles.acquireBottles(0, wanted) == true);
+        assert(bottles.getContention()[129] == 1);
+        StateLogger::flush();
+        std::cout << "Bottle word rollback test passed\n";
+    }
+
+    // Test 3c: A batch grants a maximal set of non-conflicting requests and releases them together
+    for (BottlePolicy policy: {GLOBAL_MUTEX, PER_BOTTLE_CAS, WORD_MASK}) {
+        Bottles bottles(130, policy);
+        const std::vector<int> pair = {0, 1}, overlapping = {1, 2}, far = {3, 129}, outside = {64, 128};
+        assert(bottles.acquireBottles(9, {128}));
+        const std::vector<Bottles::Request> batch = {{0, pair}, {1, overlapping}, {2, far}, {3, outside}};
+        assert(bottles.acquireBatch(batch) == std::vector<uint64_t>{0b0101});
+        assert(bottles.acquireBottles(4, {2, 64}) && !bottles.acquireBottles(4, {129}));
+
+        bottles.releaseBatch(batch);
+        assert(bottles.acquireBottles(4, {0, 1, 3, 129}));
+
+        // Owner ids index the precedence tickets, so ones outside the graph are turned away before anything moves
+        Bottles ranked(2, policy, Arbitration{Arbitration::PRECEDENCE}, 2);
+        const std::vector<int> both = {0, 1};
+        for (int owner: {-1, 2}) {
+            const std::vector<Bottles::Request> bad = {{0, both}, {owner, both}};
+            bool rejected = false;
+            try {
+                ranked.acquireBatch(bad);
+            } catch (const std::invalid_argument &) {
+                rejected = true;
+            }
+            assert(rejected && ranked.acquireBottles(1, both));
+            ranked.releaseBottles(1, both);
+        }
+        StateLogger::flush();
+        std::cout << "Batch acquisition test passed (" << policyToString(policy) << ")\n";
+    }
+
+    // Test 4: Blocking acquisition is handed over on release
+    for (BottlePolicy policy: {GLOBAL_MUTEX, PER_BOTTLE_CAS, WORD_MASK}) {
+        Bottles bottles(3, policy);
+        std::vector<int> first = {0, 1};
+        std::vector<int> second = {1, 2};
+        assert(bottles.acquireBottles(0, first) == true);
+
+        std::atomic<bool> drinking = false;
+        std::thread waiter([&] {
+            bottles.acquireBottlesBlocking(1, second);
+            drinking = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(!drinking);
+
+        bottles.releaseBottles(0);
+        waiter.join();
+        assert(drinking);
+        std::vector<int> shared = {1};
+        assert(bottles.acquireBottles(0, shared) == false);
+        StateLogger::flush();
+        std::cout << "Blocking handoff test passed (" << policyToString(policy) << ")\n";
+    }
+
+    // Test 4b: Arbitration keeps a single-bottle neighbour from cutting in front of a queued pair
+    for (const Arbitration arbitration: {Arbitration{Arbitration::GREEDY}, Arbitration{Arbitration::FIFO},
+                                         Arbitration{Arbitration::AGING, std::chrono::milliseconds(0)},
+                                         Arbitration{Arbitration::AGING, std::chrono::hours(1)},
+                                         Arbitration{Arbitration::PRECEDENCE}}) {
+        Bottles bottles(2, PER_BOTTLE_CAS, arbitration, 3);
+        std::vector<int> both = {0, 1}, first = {0}, second = {1};
+        assert(bottles.acquireBottles(1, first));
+        Bottles::Waiter pair(0), single(2);
+        assert(!bottles.acquireBottlesOrQueue(pair, both));
+
+        // Bottle 1 is free, but P0 is queued for it
+        const bool cut_in = bottles.acquireBottlesOrQueue(single, second);
+        const bool greedy = arbitration.kind == Arbitration::GREEDY || arbitration.age_limit > std::chrono::minutes(1);
+        assert(cut_in == greedy);
+        if (!cut_in) {
+            bottles.releaseBottles(1, first);
+            bottles.leaveQueues(pair);
+            assert(!bottles.acquireBottles(1, second));
+            bottles.releaseBottles(0, both);
+            bottles.leaveQueues(single);
+            assert(!bottles.acquireBottles(1, second) && bottles.acquireBottles(1, first));
+        }
+        StateLogger::flush();
+        std::cout << "Arbitration test passed (" << arbitration.toString() << ")\n";
+    }
+
+    // Test 5: Message-passing engine hands a bottle over once its holder has drunk
+    {
+        GraphBuilder builder(2);
+        builder.addEdge(0, 1, 0);
+        Graph g = builder.build();
+        MessagePassingBottles engine(g, 1);
+        std::vector<int> shared = {0};
+        assert(engine.holdsBottle(0, 0) && !engine.holdsBottle(1, 0));
+
+        // P0 starts with the bottle, so it drinks at once and P1's request is deferred until it is done
+        engine.acquireBottlesBlocking(0, shared);
+        std::atomic<bool> drinking = false;
+        std::thread neighbour([&] {
+            engine.acquireBottlesBlocking(1, shared);
+            drinking = true;
+            engine.releaseBottles(1);
+        });
+        engine.idle(0, std::chrono::milliseconds(50));
+        assert(!drinking);
+
+        engine.releaseBottles(0);
+        neighbour.join();
+        assert(drinking && !engine.holdsBottle(0, 0));
+        StateLogger::flush();
+        std::cout << "Message-passing handoff test passed\n";
+    }
+
+    // Test 5b: Sharded message engines hand a bottle across through their outboxes
+    {
+        GraphBuilder builder(2);
+        builder.addEdge(0, 1, 0);
+        Graph g = builder.build();
+        MessagePassingBottles *engines[2] = {};
+        const auto route = [&](int to) {
+            return [&engines, to](const MessagePassingBottles::Envelope &envelope) {
+                [[maybe_unused]] const bool delivered = engines[to]->deliver(envelope);
+                assert(delivered);
+            };
+        };
+        MessagePassingBottles left(g, 1, {0, 1, route(1)});
+        MessagePassingBottles right(g, 1, {1, 2, route(0)});
+        engines[0] = &left;
+        engines[1] = &right;
+        std::vector<int> shared = {0};
+
+        left.acquireBottlesBlocking(0, shared);
+        std::thread neighbour([&] {
+            right.acquireBottlesBlocking(1, shared);
+            right.releaseBottles(1);
+        });
+        left.idle(0, std::chrono::milliseconds(20));
+        left.releaseBottles(0);
+        neighbour.join();
+        assert(!left.holdsBottle(0, 0) && right.holdsBottle(1, 0));
+
+        // Envelopes no well-behaved peer would send are turned away
+        using Envelope = MessagePassingBottles::Envelope;
+        assert(!right.deliver(Envelope{7, 0, 0, 1, 0})); // unknown kind
+        assert(!right.deliver(Envelope{0, 0, 1, 0, 0})); // receiver run by the other shard
+        assert(!right.deliver(Envelope{0, 5, 0, 1, 0})); // no such bottle
+        assert(!right.deliver(Envelope{0, 0, 1, 1, 0})); // the bottle is not shared with the sender
+        StateLogger::flush();
+        std::cout << "Sharded message-passing test passed\n";
+    }
+
+    // Test 6: State Transitions
+    {
+        auto bottles = std::make_shared<Bottles>(3);
+        auto graph = std::make_shared<Graph>(GraphBuilder(3).build());
+        PhilosopherStatus status;
+        Philosopher philosopher(0, *bottles, *graph, status);
+
+        // Test initial state
+        assert(philosopher.getState() == TRANQUIL);
+
+        philosopher.publicBecomeThirsty();
+        assert(philosopher.getState() == THIRSTY);
+        StateLogger::flush();
+        std::cout << "Philosopher state transition test passed\n";
+    }
+
+    // Test 7: Discrete-event simulation covers a simulated minute without sleeping through it
+    {
+        auto graph = std::make_shared<Graph>(topology::classic());
+        auto table = std::make_shared<Bottles>(graph->getNumberOfBottles());
+        DiscreteEventSimulation simulation(graph, table);
+
+        StateLogger::setEnabled(false);
+        const auto started = std::chrono::steady_clock::now();
+        const auto summary = simulation.run(std::chrono::seconds(60));
+        StateLogger::setEnabled(true);
+
+        // Every session takes at least a second of think and drink time, and one philosopher always drinks
+        assert(summary.drinks >= 60 && summary.drinks <= 5 * 60);
+        assert(std::chrono::steady_clock::now() - started < std::chrono::seconds(1));
+        StateLogger::flush();
+        std::cout << "Discrete-event simulation test passed\n";
+    }
+
+    // Test 7a: Random streams replay from their seed, and jumped streams do not overlap their origin
+    {
+        Xoshiro256 first(42);
+        Xoshiro256 second(42);
+        Xoshiro256 jumped(42);
+        jumped.jump();
+        for (int i = 0; i < 1000; ++i) {
+            const uint64_t value = first();
+            assert(value == second() && value != jumped());
+            assert(first.below(7) < 7 && second.below(7) < 7);
+            const double unit = first.unit();
+            assert(unit > 0 && unit <= 1 && unit == second.unit());
+        }
+        StateLogger::flush();
+        std::cout << "Random stream test passed\n";
+    }
+
+    // Test 7b: Histogram percentiles are within a bucket of the exact values
+    {
+        Histogram histogram;
+        for (uint64_t value = 1; value <= 100000; ++value) {
+            histogram.record(value);
+        }
+        const auto close = [](uint64_t actual, double expected) {
+            return std::abs(static_cast<double>(actual) - expected) <= expected / 16;
+        };
+        assert(histogram.count() == 100000);
+        assert(close(histogram.percentile(0.5), 50000) && close(histogram.percentile(0.999), 99900));
+        assert(histogram.percentile(0) == 1 && close(histogram.percentile(1), 100000));
+        StateLogger::flush();
+        std::cout << "Histogram test passed\n";
+    }
+
+    // Test 8: Work-stealing pool runs every submitted task, then every timer those tasks armed
+    {
+        constexpr int TASKS = 1000;
+        std::vector<std::atomic<int> > runs(TASKS);
+        std::atomic<int> total = 0;
+        WorkStealingPool pool(2, [&](int task) {
+            if (runs[task].fetch_add(1) == 0) {
+                pool.scheduleAfter(std::chrono::milliseconds(task % 3 + 1), task);
+            }
+            total.fetch_add(1);
+        });
+        for (int task = 0; task < TASKS; ++task) {
+            pool.submit(task);
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (total.load() < 2 * TASKS && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pool.stop();
+        assert(std::ranges::all_of(runs, [](const auto &count) { return count.load() == 2; }));
+        StateLogger::flush();
+        std::cout << "Work-stealing pool test passed\n";
+    }
+
+    // Test 8a: Stopping pooled philosophers leaves every bottle free and nobody queued on the table
+    {
+        auto graph = std::make_shared<Graph>(topology::classic());
+        auto table = std::make_shared<Bottles>(graph->getNumberOfBottles(), PER_BOTTLE_CAS, Arbitration{},
+                                               graph->getNumberOfVertices());
+        const Delay brief{Delay::FIXED, 1, 1, 1};
+        StateLogger::setEnabled(false);
+        {
+            PooledPhilosophers philosophers(graph, table, 2, {brief, brief});
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            philosophers.stop();
+            for (const auto &status: philosophers.getStatuses()) {
+                assert(status.read().state == TRANQUIL && status.read().held == 0);
+            }
+        }
+        StateLogger::setEnabled(true);
+        assert(std::ranges::all_of(table->getOwners(), [](int owner) { return owner == -1; }));
+        // A release walks the queues of the bottles it frees, which would reach the destroyed tasks' waiters
+        std::vector<int> all(graph->getNumberOfBottles());
+        std::iota(all.begin(), all.end(), 0);
+        assert(table->acquireBottles(0, all));
+        table->releaseBottles(0, all);
+        StateLogger::flush();
+        std::cout << "Pool stop test passed\n";
+    }
+
+    // Test 9: A philosopher blocked on bottles somebody else holds still stops and joins on request
+    {
+        auto graph = std::make_shared<Graph>(topology::classic());
+        auto bottles = std::make_shared<Bottles>(graph->getNumberOfBottles());
+        const auto adjacent = graph->getAdjacentBottles(0);
+        const std::vector<int> held(adjacent.begin(), adjacent.end());
+        assert(bottles->acquireBottles(1, held));
+
+        PhilosopherStatus status;
+        const Delay brief{Delay::FIXED, 1, 1, 1};
+        Philosopher philosopher(0, *bottles, *graph, status, {brief, brief});
+        std::jthread thread([&](std::stop_token stop) { philosopher.run(stop); });
+        while (philosopher.getState() != THIRSTY) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        thread.request_stop();
+        thread.join();
+        assert(bottles->acquireBottles(2, held) == false);
+        bottles->releaseBottles(1, held);
+        assert(bottles->acquireBottles(2, held));
+        StateLogger::flush();
+        std::cout << "Cooperative stop test passed\n";
+    }
+
+    // Test 10: A snapshot reports each philosopher's fields together and who holds each bottle
+    {
+        auto graph = std::make_shared<Graph>(topology::classic());
+        Bottles bottles(graph->getNumberOfBottles());
+        const auto adjacent = graph->getAdjacentBottles(3);
+        const std::vector<int> held(adjacent.begin(), adjacent.end());
+        assert(bottles.acquireBottles(3, held));
+
+        // It holds every adjacent bottle, so bit i is set for each of its adjacency positions
+        const uint64_t held_mask = (uint64_t{1} << held.size()) - 1;
+        std::vector<PhilosopherStatus> statuses(2);
+        statuses[1].beginUpdate();
+        statuses[1].state.store(DRINKING, std::memory_order_relaxed);
+        statuses[1].held.store(held_mask, std::memory_order_relaxed);
+        statuses[1].drinks.store(7, std::memory_order_relaxed);
+        statuses[1].endUpdate();
+        const PhilosopherStatus::Reading reading = statuses[1].read();
+        assert(reading.state == DRINKING && reading.held == held_mask && reading.drinks == 7);
+
+        const std::string json = StatusServer::snapshot(statuses, 2, &bottles);
+        assert(json.find("{\"id\": 3, \"state\": \"DRINKING\", \"held\": " + std::to_string(held_mask)) !=
+               std::string::npos);
+        assert(json.find("{\"id\": 2, \"state\": \"TRANQUIL\"") != std::string::npos);
+        const std::vector<int> owners = bottles.getOwners();
+        for (int b = 0; b < static_cast<int>(owners.size()); ++b) {
+            const bool mine = std::find(held.begin(), held.end(), b) != held.end();
+            assert(owners[b] == (mine ? 3 : -1));
+        }
+        assert(StatusServer::snapshot(statuses, 2, nullptr).find("\"bottles\": null") != std::string::npos);
+        assert(quoteJson("a\"b\\c\n") == "\"a\\\"b\\\\c\\u000a\"");
+        bottles.releaseBottles(3, held);
+        std::cout << "Snapshot test passed\n";
+    }
+
+#ifdef COUNT_ALLOCATIONS
+    // Test 11: Once warmed up, a philosopher's thirst, acquire, drink and release cycle, logging included, makes no
+    // heap allocation
+    for (BottlePolicy policy: {GLOBAL_MUTEX, PER_BOTTLE_CAS, WORD_MASK}) {
+        auto graph = std::make_shared<Graph>(topology::classic());
+        Bottles bottles(graph->getNumberOfBottles(), policy);
+        PhilosopherStatus status;
+        const Delay none{Delay::FIXED, 0, 0, 0};
+        Philosopher philosopher(0, bottles, *graph, status, {none, none}, Xoshiro256(11));
+        std::stop_source stop;
+        const auto cycle = [&] {
+            bottles.idle(0, philosopher.startThinking(), stop.get_token());
+            philosopher.finishThinking();
+            philosopher.becomeThirsty();
+            const auto retries = bottles.acquireBottlesBlocking(0, philosopher.getRequiredBottles(), stop.get_token());
+            assert(retries == 0);
+            philosopher.onBottlesAcquired(*retries);
+            bottles.idle(0, philosopher.startDrinking(), stop.get_token());
+            philosopher.finishDrinking();
+            philosopher.releaseBottles();
+        };
+
+        // Records go through this thread's ring and the logger thread as in any run, minus the text output.
+        // Flushing every few cycles keeps the ring from filling up, so none are dropped instead of queued.
+        constexpr int RECORDS_PER_CYCLE = 9; // 7 by the philosopher, the claim and the free by the table
+        const auto cycles = [&](int count) {
+            for (int i = 0; i < count; ++i) {
+                cycle();
+                if (i % 64 == 63) {
+                    StateLogger::flush();
+                }
+            }
+        };
+        StateLogger::setDiscarding(true);
+        // The first cycles size the per-thread buffers and register this thread's log ring and metrics shard
+        cycles(100);
+        const uint64_t before = heap_allocations;
+        cycles(10000);
+        const uint64_t allocations = heap_allocations - before;
+        const uint64_t logged = StateLogger::setDiscarding(false);
+        assert(allocations == 0);
+        assert(logged == 10100 * RECORDS_PER_CYCLE);
+        assert(status.read().drinks == 10100);
+        std::cout << "Allocation-free cycle test passed (" << policyToString(policy) << ")\n";
+    }
+#endif // COUNT_ALLOCATIONS
+
+}
+
+// Engines main can run the simulation on
+enum EngineKind {
+    TABLE_ENGINE, // central Bottles table
+    MESSAGE_ENGINE // MessagePassingBottles, no central arbiter
+};
+
+enum DriverKind {
+    THREAD_DRIVER, // one OS thread per philosopher
+    POOL_DRIVER, // PooledPhilosophers on a work-stealing pool
+    DES_DRIVER // DiscreteEventSimulation on a simulated clock
+};
+
+std::string driverToString(DriverKind driver) {
+    switch (driver) {
+        case THREAD_DRIVER: return "threads";
+        case POOL_DRIVER: return "pool";
+        case DES_DRIVER: return "des";
+        default: return "unknown";
+    }
+}
+
+// Command line switches accepted by main
+struct Options {
+    EngineKind engine = TABLE_ENGINE;
+    BottlePolicy policy = PER_BOTTLE_CAS;
+    Arbitration arbitration;
+    std::string trace_path; // Binary trace instead of text logs when set
+    std::string topology = "classic"; // See topology::fromSpec
+    uint64_t seed = 0; // Seed for the random topologies, and for the philosophers of --des and --bench runs
+    DriverKind driver = THREAD_DRIVER;
+    int duration = SIMULATION; // Seconds to simulate, real or simulated; 0 for no time limit
+    uint64_t transitions = 0; // Ends the run once the philosophers made this many state changes; 0 for no limit
+    int runs = 1; // Back-to-back runs in one process, each with the next seed
+    int workers = std::max(1u, std::thread::hardware_concurrency()); // Pool size
+    Schedule schedule;
+    int host = -1; // Index into hosts of this process in a distributed run; -1 runs the whole graph here
+    std::vector<std::string> hosts; // "name:port" of every process of a distributed run, in host order
+    bool numa = false; // Partition the graph and place each partition on a NUMA node
+    int partitions = 0; // With numa; 0 for one partition per node
+    std::string serve; // Where to serve live snapshots; see StatusServer
+    bool bench = false; // No tests, no logging, one line of JSON at the end
+};
+
+void usage(const char *program) {
+    std::cerr << "usage: " << program << " [--engine=table|message] [--policy=mutex|cas|mask] [--trace=<file>]\n"
+            << "       [--arbitration=greedy|fifo|aging:MS|precedence]\n"
+            << "       [--topology=classic|ring:N|grid:WxH|torus:WxH|regular:N:D|powerlaw:N:M|file:PATH] [--seed=S]\n"
+            << "       [--des] [--duration=SECS] [--pool] [--workers=N]\n"
+            << "       [--think=DELAY] [--drink=DELAY] with DELAY uniform:MIN:MAX|exp:MEAN|fixed:MS in ms\n"
+            << "       [--transitions=N] [--bench] [--runs=N] [--placement=none|numa|numa:PARTITIONS]\n"
+            << "       [--hosts=NAME:PORT,NAME:PORT,... --host=INDEX] to run one shard of a message-engine graph\n"
+            << "       [--serve=PORT|NAME:PORT|unix:PATH] to serve JSON snapshots of the running simulation\n"
+            << "       --transitions alone lifts the default time limit; pass --duration as well to keep one\n";
+    exit(1);
+}
+
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    bool duration_given = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--engine=table") {
+            options.engine = TABLE_ENGINE;
+        } else if (arg == "--engine=message") {
+            options.engine = MESSAGE_ENGINE;
+        } else if (arg == "--policy=mutex") {
+            options.policy = GLOBAL_MUTEX;
+        } else if (arg == "--policy=cas") {
+            options.policy = PER_BOTTLE_CAS;
+        } else if (arg == "--policy=mask") {
+            options.policy = WORD_MASK;
+        } else if (arg.starts_with("--trace=") && arg.size() > 8) {
+            options.trace_path = arg.substr(8);
+        } else if (arg.starts_with("--topology=")) {
+            options.topology = arg.substr(11);
+        } else if (arg.starts_with("--seed=")) {
+            if (std::from_chars(arg.data() + 7, arg.data() + arg.size(), options.seed).ec != std::errc()) {
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--arbitration=")) {
+            try {
+                options.arbitration = Arbitration::parse(arg.substr(14));
+            } catch (const std::invalid_argument &error) {
+                std::cerr << error.what() << "\n";
+                usage(argv[0]);
+            }
+        } else if (arg == "--des") {
+            options.driver = DES_DRIVER;
+        } else if (arg == "--pool") {
+            options.driver = POOL_DRIVER;
+        } else if (arg.starts_with("--hosts=")) {
+            options.hosts.clear();
+            for (std::string_view list = arg.substr(8); !list.empty();) {
+                const size_t comma = std::min(list.find(','), list.size());
+                options.hosts.emplace_back(list.substr(0, comma));
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+        } else if (arg.starts_with("--host=")) {
+            const auto [end, ec] = std::from_chars(arg.data() + 7, arg.data() + arg.size(), options.host);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.host < 0) {
+                usage(argv[0]);
+            }
+        } else if (arg == "--placement=none") {
+            options.numa = false;
+        } else if (arg == "--placement=numa") {
+            options.numa = true;
+            options.partitions = 0;
+        } else if (arg.starts_with("--placement=numa:")) {
+            options.numa = true;
+            const auto [end, ec] = std::from_chars(arg.data() + 17, arg.data() + arg.size(), options.partitions);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.partitions <= 0) {
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--workers=")) {
+            const auto [end, ec] = std::from_chars(arg.data() + 10, arg.data() + arg.size(), options.workers);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.workers <= 0) {
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--duration=")) {
+            const auto [end, ec] = std::from_chars(arg.data() + 11, arg.data() + arg.size(), options.duration);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.duration <= 0) {
+                usage(argv[0]);
+            }
+            duration_given = true;
+        } else if (arg.starts_with("--transitions=")) {
+            const auto [end, ec] = std::from_chars(arg.data() + 14, arg.data() + arg.size(), options.transitions);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.transitions == 0) {
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--runs=")) {
+            const auto [end, ec] = std::from_chars(arg.data() + 7, arg.data() + arg.size(), options.runs);
+            if (ec != std::errc() || end != arg.data() + arg.size() || options.runs <= 0) {
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--think=") || arg.starts_with("--drink=")) {
+            try {
+                (arg[2] == 't' ? options.schedule.think : options.schedule.drink) = Delay::parse(arg.substr(8));
+            } catch (const std::invalid_argument &error) {
+                std::cerr << error.what() << "\n";
+                usage(argv[0]);
+            }
+        } else if (arg.starts_with("--serve=") && arg.size() > 8) {
+            options.serve = arg.substr(8);
+        } else if (arg == "--bench") {
+            options.bench = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.transitions > 0 && !duration_given) {
+        options.duration = 0;
+    }
+    // Simulated time would never advance, so only a transition limit could end the run
+    if (options.driver == DES_DRIVER && options.transitions == 0 && options.schedule.think.alwaysZero() &&
+        options.schedule.drink.alwaysZero()) {
+        std::cerr << "--des with 0 ms thinks and drinks needs --transitions to end\n";
+        usage(argv[0]);
+    }
+    if (options.engine == MESSAGE_ENGINE && options.driver != THREAD_DRIVER) {
+        std::cerr << "--" << driverToString(options.driver) << " runs the table engine only\n";
+        usage(argv[0]);
+    }
+    if ((options.host >= 0) != !options.hosts.empty() || options.host >= static_cast<int>(options.hosts.size())) {
+        std::cerr << "--host and --hosts go together, with --host indexing the list\n";
+        usage(argv[0]);
+    }
+    if (options.host >= 0 && (options.engine != MESSAGE_ENGINE || options.driver != THREAD_DRIVER || options.numa)) {
+        std::cerr << "Distributed runs need --engine=message on threads, without --placement\n";
+        usage(argv[0]);
+    }
+    if (options.engine == MESSAGE_ENGINE && options.arbitration.kind != Arbitration::GREEDY) {
+        std::cerr << "--arbitration applies to the table engine; the message engine orders by thirst already\n";
+        usage(argv[0]);
+    }
+    if (options.numa && options.driver == DES_DRIVER) {
+        std::cerr << "--placement needs threads to place; --des runs on one\n";
+        usage(argv[0]);
+    }
+    return options;
+}
+
+// What a run leaves behind for the report
+struct RunResult {
+    double wall_secs = 0;
+    double simulated_secs = 0; // Equal to wall_secs except under the discrete-event driver
+    uint64_t events = 0; // Discrete-event driver only
+    uint64_t envelopes_sent = 0; // Distributed runs only: messages to other hosts
+    uint64_t frames_sent = 0; // The batches they went out in
+    uint64_t transitions = 0;
+    std::vector<uint64_t> drinks; // Per philosopher
+    std::vector<uint64_t> contention; // Per bottle
+    double cpu_user_secs = 0;
+    double cpu_system_secs = 0;
+};
+
+// Process CPU time so far, as (user, system) seconds
+std::pair<double, double> cpuSeconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    const auto secs = [](const timeval &time) { return time.tv_sec + time.tv_usec / 1e6; };
+    return {secs(usage.ru_utime), secs(usage.ru_stime)};
+}
+
+// Blocks the calling thread until the run's time is up or its philosophers made enough state changes
+void waitForEndOfRun(const Options &options, std::span<const PhilosopherStatus> statuses,
+                     std::chrono::steady_clock::time_point started) {
+    if (options.transitions == 0) {
+        std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+        return;
+    }
+    constexpr auto POLL = std::chrono::milliseconds(1);
+    const auto deadline = options.duration > 0
+                              ? started + std::chrono::seconds(options.duration)
+                              : std::chrono::steady_clock::time_point::max();
+    while (std::chrono::steady_clock::now() < deadline &&
+           PhilosopherStatus::transitionsOf(statuses) < options.transitions) {
+        std::this_thread::sleep_for(POLL);
+    }
+}
+
+/**
+ * Runs the philosophers once on a fresh engine with the chosen driver, then stops them and tears everything down,
+ * so it can be called again in the same process.
+ * Back-to-back runs do not reuse warm threads: each call starts its own philosopher threads or work-stealing pool,
+ * and a transport, and joins them before returning. Only log rings and metric shards carry over from run to run.
+ * @param options The run's engine, driver, schedule and limits.
+ * @param graph The topology.
+ * @param seed Seed for the philosophers' random streams.
+ * @param plan Where graph's partitions run: NUMA nodes, or with --host the hosts; null to leave threads and memory
+ *             where they fall.
+ * @param server Where to publish the run while it is going, or null.
+ * @throws std::runtime_error if a distributed run cannot reach the other hosts.
+ */
+RunResult simulate(const Options &options, const std::shared_ptr<Graph> &graph, uint64_t seed,
+                   const placement::Plan *plan = nullptr, StatusServer *server = nullptr) {
+    const int number_of_philosophers = graph->getNumberOfVertices();
+    const int number_of_bottles = graph->getNumberOfBottles();
+    const bool distributed = options.host >= 0;
+    const int first = distributed ? plan->philosopher_begin[options.host] : 0;
+    const int last = distributed ? plan->philosopher_begin[options.host + 1] : number_of_philosophers;
+    const placement::Plan *numa = distributed ? nullptr : plan;
+
+    std::shared_ptr<BottleEngine> bottles;
+    std::unique_ptr<TcpTransport> transport; // After bottles, so it stops delivering before the engine goes
+    if (distributed) {
+        // Meeting the other hosts here lines the runs up; the engine only starts hearing from them once it exists
+        transport = std::make_unique<TcpTransport>(options.host, options.hosts, plan->philosopher_begin);
+        auto engine = std::make_shared<MessagePassingBottles>(
+            *graph, number_of_bottles, MessagePassingBottles::Shard{
+                first, last, [link = transport.get()](const auto &envelope) { link->send(envelope); }
+            });
+        transport->start([&engine = *engine](const auto &envelope) { return engine.deliver(envelope); });
+        bottles = engine;
+    } else if (options.engine == MESSAGE_ENGINE) {
+        bottles = std::make_shared<MessagePassingBottles>(*graph, number_of_bottles);
+    } else {
+        bottles = std::make_shared<Bottles>(number_of_bottles, options.policy, options.arbitration,
+                                            number_of_philosophers);
+    }
+    const auto table = std::dynamic_pointer_cast<Bottles>(bottles);
+    if (table && numa) {
+        table->bindToNodes(*numa);
+    }
+
+    RunResult result;
+    const auto [user_before, system_before] = cpuSeconds();
+    const auto started = std::chrono::steady_clock::now();
+    if (options.driver == DES_DRIVER) {
+        DiscreteEventSimulation simulation(graph, table, options.schedule, seed);
+        const auto duration = options.duration > 0
+                                  ? std::chrono::nanoseconds(std::chrono::seconds(options.duration))
+                                  : std::chrono::nanoseconds::max();
+        if (server) {
+            server->expose(simulation.getStatuses(), 0, table.get());
+        }
+        const auto summary = simulation.run(duration, options.transitions > 0 ? options.transitions : UINT64_MAX);
+        if (server) {
+            server->conceal();
+        }
+        result.wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.simulated_secs = summary.simulated_ns / 1e9;
+        result.events = summary.events;
+        result.transitions = PhilosopherStatus::transitionsOf(simulation.getStatuses());
+        result.drinks = PhilosopherStatus::drinksOf(simulation.getStatuses());
+    } else if (options.driver == POOL_DRIVER) {
+        PooledPhilosophers philosophers(graph, table, options.workers, options.schedule, seed, numa);
+        if (server) {
+            server->expose(philosophers.getStatuses(), 0, table.get());
+        }
+        waitForEndOfRun(options, philosophers.getStatuses(), started);
+        philosophers.stop();
+        if (server) {
+            server->conceal();
+        }
+        result.wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.transitions = PhilosopherStatus::transitionsOf(philosophers.getStatuses());
+        result.drinks = PhilosopherStatus::drinksOf(philosophers.getStatuses());
+    } else {
+        // Only this host's philosophers run here; their slots keep the ids of the whole graph
+        std::vector<PhilosopherStatus> statuses(number_of_philosophers);
+        const std::span<const PhilosopherStatus> local = std::span(statuses).subspan(first, last - first);
+        std::vector<std::unique_ptr<Philosopher> > philosophers;
+        if (numa) {
+            numa->bindByPhilosopher(std::span(statuses));
+        }
+
+        // Initialize philosophers, each with its own stream split off the run's seed, wherever it runs
+        philosophers.reserve(last - first);
+        Xoshiro256 streams(seed);
+        for (int idx = 0; idx < last; ++idx) {
+            if (idx >= first) {
+                philosophers.emplace_back(std::make_unique<Philosopher>(idx, *bottles, *graph, statuses[idx],
+                                                                        options.schedule, streams));
+            }
+            streams.jump();
+        }
+
+        // Start philosopher threads; each jthread hands its own stop token to run(), after pinning itself if placed
+        std::vector<std::jthread> threads;
+        threads.reserve(last - first);
+        for (int idx = first; idx < last; ++idx) {
+            threads.emplace_back([&philosopher = *philosophers[idx - first], numa, idx](std::stop_token stop) {
+                if (numa) {
+                    placement::pinCurrentThread(numa->nodes[numa->partitionOf(idx)].cpus);
+                }
+                philosopher.run(stop);
+            });
+        }
+
+        // Run simulation for specified duration, then ask everyone to stop before joining anyone
+        if (server) {
+            server->expose(local, first, table.get());
+        }
+        waitForEndOfRun(options, local, started);
+        for (auto &thread: threads) {
+            thread.request_stop();
+        }
+        threads.clear();
+        if (server) {
+            server->conceal();
+        }
+        result.wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        result.transitions = PhilosopherStatus::transitionsOf(local);
+        result.drinks = PhilosopherStatus::drinksOf(local);
+    }
+    if (transport) {
+        result.envelopes_sent = transport->getEnvelopesSent();
+        result.frames_sent = transport->getFramesSent();
+    }
+    if (options.driver != DES_DRIVER) {
+        result.simulated_secs = result.wall_secs;
+    }
+    const auto [user_after, system_after] = cpuSeconds();
+    result.cpu_user_secs = user_after - user_before;
+    result.cpu_system_secs = system_after - system_before;
+    result.contention = bottles->getContention();
+    return result;
+}
+
+// Prints a --bench run as a single JSON object
+void printBenchJson(const Options &options, const Graph &graph, uint64_t seed, const RunResult &result,
+                    const placement::Plan *plan) {
+    const Metrics::Summary metrics = Metrics::summarize(result.drinks, result.contention);
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    const auto ms = [](uint64_t ns) { return ns / 1e6; };
+    std::cout << "{\"engine\": \"" << (options.engine == MESSAGE_ENGINE ? "message" : "table") << "\""
+            << ", \"policy\": \"" << policyToString(options.policy) << "\""
+            << ", \"arbitration\": \"" << options.arbitration.toString() << "\""
+            << ", \"driver\": \"" << driverToString(options.driver) << "\""
+            << ", \"workers\": " << (options.driver == POOL_DRIVER ? options.workers : 0)
+            << ", \"topology\": " << quoteJson(options.topology)
+            << ", \"philosophers\": " << graph.getNumberOfVertices()
+            << ", \"bottles\": " << graph.getNumberOfBottles()
+            << ", \"partitions\": " << (plan ? plan->getNumberOfPartitions() : 0)
+            << ", \"cut_edges\": " << (plan ? plan->cut_edges : 0)
+            << ", \"host\": " << options.host
+            << ", \"remote_messages\": " << result.envelopes_sent
+            << ", \"remote_frames\": " << result.frames_sent
+            << ", \"seed\": " << seed
+            << ", \"think\": \"" << options.schedule.think.toString() << "\""
+            << ", \"drink\": \"" << options.schedule.drink.toString() << "\""
+            << ", \"simulated_secs\": " << result.simulated_secs
+            << ", \"wall_secs\": " << result.wall_secs
+            << ", \"transitions\": " << result.transitions
+            << ", \"transitions_per_sec\": " << result.transitions / std::max(result.wall_secs, 1e-9)
+            << ", \"acquisitions\": " << metrics.acquisitions
+            << ", \"wait_ms\": {\"p50\": " << ms(metrics.wait_p50_ns) << ", \"p99\": " << ms(metrics.wait_p99_ns)
+            << ", \"p999\": " << ms(metrics.wait_p999_ns) << ", \"max\": " << ms(metrics.wait_max_ns) << "}"
+            << ", \"retries\": {\"mean\": " << metrics.retries_mean << ", \"p99\": " << metrics.retries_p99
+            << ", \"max\": " << metrics.retries_max << "}"
+            << ", \"drinks\": " << metrics.drinks
+            << ", \"jain_fairness\": " << metrics.jain_fairness
+            << ", \"cpu\": {\"user_secs\": " << result.cpu_user_secs << ", \"system_secs\": " << result.cpu_system_secs
+            << ", \"utilization\": "
+            << (result.cpu_user_secs + result.cpu_system_secs) / std::max(result.wall_secs * cores, 1e-9) << "}}"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const Options options = parseOptions(argc, argv);
+    // Seeded runs replay the same random decisions; the plain demo keeps varying from run to run
+    const uint64_t run_seed = options.bench || options.driver == DES_DRIVER ? options.seed : std::random_device()();
+    if (!options.trace_path.empty()) {
+        StateLogger::traceTo(options.trace_path);
+    }
+
+    if (!options.bench) {
+        alphaTests();
+
+        StateLogger::flush();
+        std::cout << "\n================ BETA TESTS ================\n";
+    }
+
+    // Create and initialize the graph
+    std::shared_ptr<Graph> graph;
+    try {
+        graph = std::make_shared<Graph>(topology::fromSpec(options.topology, options.seed));
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << "\n";
+        usage(argv[0]);
+    }
+
+    if (options.arbitration.kind == Arbitration::PRECEDENCE &&
+        graph->getNumberOfVertices() > Bottles::MAX_PRECEDENCE_PHILOSOPHERS) {
+        std::cerr << "--arbitration=precedence takes at most " << Bottles::MAX_PRECEDENCE_PHILOSOPHERS
+                  << " philosophers\n";
+        usage(argv[0]);
+    }
+
+    // Renumbers the graph, so ids in the logs and reports are those of the partitioned order
+    std::optional<placement::Plan> plan;
+    if (options.numa) {
+        const auto nodes = placement::onlineNodes();
+        const int partitions = options.partitions > 0 ? options.partitions : static_cast<int>(nodes.size());
+        plan = placement::partition(*graph, partitions, nodes);
+    } else if (options.host >= 0) {
+        // Every host cuts the same graph the same way; partition k is host k, whatever node it lands on
+        plan = placement::partition(*graph, static_cast<int>(options.hosts.size()), placement::onlineNodes());
+    }
+
+    // Benchmarks only record into a trace; so does the discrete-event driver, whose text would dwarf the run
+    if (options.bench || options.driver == DES_DRIVER) {
+        StateLogger::setEnabled(!options.trace_path.empty());
+    }
+    if (!options.bench) {
+        const std::string engine_name = options.engine == MESSAGE_ENGINE
+                                            ? "message-passing"
+                                            : policyToString(options.policy) + " table";
+        std::cout << "=== Simulating " << graph->getNumberOfVertices() << " Drinking Philosophers for ";
+        if (options.duration > 0) {
+            std::cout << options.duration << (options.driver == DES_DRIVER ? " simulated" : "") << " secs";
+        }
+        if (options.transitions > 0) {
+            std::cout << (options.duration > 0 ? " or " : "") << options.transitions << " transitions";
+        }
+        std::cout << " (" << engine_name << " engine, ";
+        if (options.engine == TABLE_ENGINE) {
+            std::cout << options.arbitration.toString() << " arbitration, ";
+        }
+        std::cout << driverToString(options.driver) << ") ===" << std::endl;
+        if (options.host >= 0) {
+            std::cout << "Host " << options.host << " of " << options.hosts.size() << " runs philosophers "
+                    << plan->philosopher_begin[options.host] << " to " << plan->philosopher_begin[options.host + 1] - 1
+                    << ", " << plan->cut_edges << " of " << graph->getNumberOfEdges() << " edges cross hosts"
+                    << std::endl;
+        } else if (plan) {
+            std::cout << "Placed " << plan->getNumberOfPartitions() << " partitions on nodes";
+            for (const auto &node: plan->nodes) {
+                std::cout << " " << node.id;
+            }
+            std::cout << ", " << plan->cut_edges << " of " << graph->getNumberOfEdges() << " edges cut" << std::endl;
+        }
+        if (options.driver != DES_DRIVER) {
+            std::cout << "Time\t[Phil]\tState\t|\tAction" << std::endl;
+            std::cout << "-------------------------------------------" << std::endl;
+        }
+    }
+
+    std::optional<StatusServer> server;
+    if (!options.serve.empty()) {
+        try {
+            server.emplace(options.serve);
+        } catch (const std::runtime_error &error) {
+            std::cerr << error.what() << "\n";
+            return 1;
+        }
+        if (!options.bench) {
+            std::cout << "Serving snapshots on " << options.serve << std::endl;
+        }
+    }
+
+    for (int run = 0; run < options.runs; ++run) {
+        // Every thread of the previous run has been joined, so the counters can be cleared safely
+        Metrics::reset();
+        RunResult result;
+        try {
+            result = simulate(options, graph, run_seed + run, plan ? &*plan : nullptr, server ? &*server : nullptr);
+        } catch (const std::runtime_error &error) {
+            std::cerr << error.what() << "\n";
+            return 1;
+        }
+        StateLogger::flush();
+
+        if (options.bench) {
+            printBenchJson(options, *graph, run_seed + run, result, plan ? &*plan : nullptr);
+            continue;
+        }
+        if (options.driver == DES_DRIVER) {
+            std::cout << "Simulated " << result.simulated_secs << " secs in " << result.wall_secs << " secs: "
+                    << result.events << " events, " << result.transitions << " transitions, "
+                    << static_cast<uint64_t>(result.events / std::max(result.wall_secs, 1e-9)) << " events/sec"
+                    << std::endl;
+        }
+        if (options.host >= 0) {
+            std::cout << "Sent " << result.envelopes_sent << " messages to other hosts in " << result.frames_sent
+                    << " frames" << std::endl;
+        }
+        Metrics::report(Metrics::summarize(result.drinks, result.contention));
+    }
     return 0;
 }
 
@@ -0,0 +1,462 @@
+#ifndef __philosopher_trace_h__
+#define __philosopher_trace_h__
+
+/*
+ * Record layout shared by the drinking philosophers simulation and trace_decoder.
+ *
+ * Binary trace file:
+ *   "DPTRACE1"                                         8 byte magic
+ *   varint steady_start_ns, varint wall_start_ns       clocks sampled together when the trace was opened
+ *   records until the end of the file or the first zero byte, each one
+ *     varint zigzag(timestamp_ns - previous timestamp_ns) + 1
+ *     varint philosopher_id, varint table_id
+ *     byte   state | action << 2 | CONTINUED << 6
+ *     varint bottle_count, bottle_count x varint bottle id
+ *
+ * No record starts with a zero byte, so the zero-filled tail of a trace that was never trimmed
+ * (the process died before TraceWriter::close) simply reads as the end of the trace.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Enumeration to represent the state of a philosopher
+enum State { TRANQUIL, THIRSTY, DRINKING };
+
+// Utility function to convert a State enum to its corresponding string
+inline std::string stateToString(State state) {
+    switch (state) {
+        case TRANQUIL: return "TRANQUIL";
+        case THIRSTY: return "THIRSTY";
+        case DRINKING: return "DRINKING";
+        default: return "UNKNOWN";
+    }
+}
+
+// What a log record reports; TABLE_* records describe a Bottles table rather than a philosopher
+enum Action : uint8_t {
+    STARTED_THINKING,
+    FINISHED_THINKING,
+    NEEDS_BOTTLES,
+    ACQUIRED_BOTTLES,
+    STARTED_DRINKING,
+    FINISHED_DRINKING,
+    RELEASED_BOTTLES,
+    TABLE_OPENED, // philosopher_id carries the number of bottles of the new table
+    TABLE_CLAIMED, // the listed bottles now belong to philosopher_id
+    TABLE_FREED // the listed bottles were given back by philosopher_id
+};
+
+// Utility function to convert a philosopher Action to the text logged for it
+inline const char *actionToString(Action action) {
+    switch (action) {
+        case STARTED_THINKING: return "Started thinking";
+        case FINISHED_THINKING: return "Finished thinking";
+        case NEEDS_BOTTLES: return "Needs bottles: ";
+        case ACQUIRED_BOTTLES: return "Acquired bottles";
+        case STARTED_DRINKING: return "Started drinking";
+        case FINISHED_DRINKING: return "Finished drinking";
+        case RELEASED_BOTTLES: return "Released bottles";
+        default: return "Unknown";
+    }
+}
+
+// Utility function to convert an Action to the identifier used in CSV output
+inline const char *actionName(Action action) {
+    switch (action) {
+        case STARTED_THINKING: return "STARTED_THINKING";
+        case FINISHED_THINKING: return "FINISHED_THINKING";
+        case NEEDS_BOTTLES: return "NEEDS_BOTTLES";
+        case ACQUIRED_BOTTLES: return "ACQUIRED_BOTTLES";
+        case STARTED_DRINKING: return "STARTED_DRINKING";
+        case FINISHED_DRINKING: return "FINISHED_DRINKING";
+        case RELEASED_BOTTLES: return "RELEASED_BOTTLES";
+        case TABLE_OPENED: return "TABLE_OPENED";
+        case TABLE_CLAIMED: return "TABLE_CLAIMED";
+        case TABLE_FREED: return "TABLE_FREED";
+        default: return "UNKNOWN";
+    }
+}
+
+/*
+ * Fixed-size binary log record. Bottle lists longer than MAX_BOTTLES are split over consecutive records
+ * that share a timestamp; every chunk but the last carries the CONTINUED flag.
+ */
+struct LogRecord {
+    static constexpr int MAX_BOTTLES = 5;
+    static constexpr uint8_t CONTINUED = 1;
+
+    int64_t timestamp_ns; // steady_clock
+    int32_t philosopher_id;
+    uint16_t table_id;
+    uint8_t state;
+    uint8_t action;
+    uint8_t flags;
+    uint8_t bottle_count;
+    int32_t bottles[MAX_BOTTLES];
+};
+
+/**
+ * Turns LogRecords back into the simulation's text layout or into CSV.
+ * Records must be fed in timestamp order. The "Bottles: [...]" lines are rebuilt from the TABLE_* records,
+ * which keep a mirror of every table's owners.
+ */
+class TraceFormatter {
+public:
+    /**
+      * @param steady_start A steady_clock reading, in nanoseconds...
+      * @param wall_start ...and the system_clock reading, in nanoseconds since the epoch, taken at the same moment.
+      */
+    TraceFormatter(int64_t steady_start, int64_t wall_start) : steady_start(steady_start), wall_start(wall_start) {
+    }
+
+    // Appends the text lines for record, if it completes any, to out
+    void text(const LogRecord &record, std::string &out) {
+        if (record.action >= TABLE_OPENED) {
+            if (updateTable(record) && record.action != TABLE_OPENED) {
+                appendTable(record.table_id, out);
+            }
+            return;
+        }
+        if (!continuing) {
+            char buffer[96];
+            snprintf(buffer, sizeof(buffer), "%s [P%d] %8s | %s", clockText(record.timestamp_ns),
+                     record.philosopher_id, stateToString(static_cast<State>(record.state)).c_str(),
+                     actionToString(static_cast<Action>(record.action)));
+            out += buffer;
+        }
+        for (int i = 0; i < record.bottle_count; ++i) {
+            if (continuing || i > 0) out += ", ";
+            out += std::to_string(record.bottles[i]);
+        }
+        continuing = record.flags & LogRecord::CONTINUED;
+        if (!continuing) {
+            out += '\n';
+        }
+    }
+
+    // Appends the CSV row for record, if it completes one, to out
+    void csv(const LogRecord &record, std::string &out) {
+        const bool table = record.action >= TABLE_OPENED;
+        if (table) {
+            updateTable(record);
+        }
+        if (!continuing) {
+            char buffer[96];
+            if (table) {
+                snprintf(buffer, sizeof(buffer), "%lld,%u,%d,,%s,", static_cast<long long>(record.timestamp_ns),
+                         record.table_id, record.philosopher_id, actionName(static_cast<Action>(record.action)));
+            } else {
+                snprintf(buffer, sizeof(buffer), "%lld,,%d,%s,%s,", static_cast<long long>(record.timestamp_ns),
+                         record.philosopher_id, stateToString(static_cast<State>(record.state)).c_str(),
+                         actionName(static_cast<Action>(record.action)));
+            }
+            out += buffer;
+        }
+        for (int i = 0; i < record.bottle_count; ++i) {
+            if (continuing || i > 0) out += ';';
+            out += std::to_string(record.bottles[i]);
+        }
+        continuing = record.flags & LogRecord::CONTINUED;
+        if (!continuing) {
+            out += '\n';
+        }
+    }
+
+    static const char *csvHeader() {
+        return "timestamp_ns,table,philosopher,state,action,bottles\n";
+    }
+
+    // TABLE_* records left out of the mirror because they name a table never opened, or bottles it does not have
+    uint64_t getSkippedTableRecords() const {
+        return skipped_table_records;
+    }
+
+private:
+    const int64_t steady_start;
+    const int64_t wall_start;
+    std::vector<std::vector<int> > tables; // [table_id][bottle] = owner, -1 when free
+    bool continuing = false; // The previous record announced a continuation
+    uint64_t skipped_table_records = 0;
+    time_t cached_second = 0;
+    char cached_clock[16] = {};
+
+    /*
+     * Applies a TABLE_* record to the mirror; returns whether it completed a change.
+     * A trace may be truncated, corrupt, or missing the TABLE_OPENED a full log ring dropped, so a record for a table
+     * never opened is skipped, as are bottles outside its table; either way the record counts as skipped.
+     */
+    bool updateTable(const LogRecord &record) {
+        if (record.action == TABLE_OPENED) {
+            if (record.philosopher_id < 0) {
+                ++skipped_table_records;
+                return false;
+            }
+            if (tables.size() <= record.table_id) tables.resize(record.table_id + 1);
+            tables[record.table_id].assign(record.philosopher_id, -1);
+            return true;
+        }
+        if (record.table_id >= tables.size() || tables[record.table_id].empty()) {
+            ++skipped_table_records;
+            return false;
+        }
+        auto &owners = tables[record.table_id];
+        bool skipped = false;
+        for (int i = 0; i < record.bottle_count; ++i) {
+            if (record.bottles[i] < 0 || static_cast<size_t>(record.bottles[i]) >= owners.size()) {
+                skipped = true;
+                continue;
+            }
+            int &owner = owners[record.bottles[i]];
+            if (record.action == TABLE_CLAIMED) {
+                owner = record.philosopher_id;
+            } else if (owner == record.philosopher_id) {
+                // Records of different threads may be drained out of order; a stale free must not undo a claim
+                owner = -1;
+            }
+        }
+        skipped_table_records += skipped;
+        return !(record.flags & LogRecord::CONTINUED);
+    }
+
+    void appendTable(uint16_t table_id, std::string &out) const {
+        const auto &owners = tables[table_id];
+        out += "Bottles: [";
+        for (size_t i = 0; i < owners.size(); ++i) {
+            if (i > 0) out += ", ";
+            out += owners[i] == -1 ? "Free" : "P" + std::to_string(owners[i]);
+        }
+        out += "]\n";
+    }
+
+    const char *clockText(int64_t timestamp_ns) {
+        const time_t second = static_cast<time_t>((wall_start + (timestamp_ns - steady_start)) / 1000000000);
+        if (second != cached_second) {
+            std::tm local{};
+            localtime_r(&second, &local);
+            strftime(cached_clock, sizeof(cached_clock), "%H:%M:%S", &local);
+            cached_second = second;
+        }
+        return cached_clock;
+    }
+};
+
+namespace trace {
+    constexpr char MAGIC[8] = {'D', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+
+    inline uint8_t *putVarint(uint8_t *out, uint64_t value) {
+        while (value >= 0x80) {
+            *out++ = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<uint8_t>(value);
+        return out;
+    }
+
+    // Returns nullptr if the varint runs past end
+    inline const uint8_t *getVarint(const uint8_t *in, const uint8_t *end, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; in != end && shift < 64; shift += 7) {
+            const uint8_t byte = *in++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return in;
+            }
+        }
+        return nullptr;
+    }
+
+    inline uint64_t zigzag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    // Worst case encoded size of one record
+    constexpr size_t MAX_RECORD_BYTES = 10 + 5 + 3 + 1 + 1 + 5 * LogRecord::MAX_BOTTLES + 1;
+}
+
+/**
+ * Appends LogRecords to a memory-mapped binary trace file.
+ * The mapping grows by doubling; close() trims the file to the bytes actually written.
+ */
+class TraceWriter {
+public:
+    /**
+      * Creates or truncates the trace file and writes its header.
+      * @param path Where the trace goes.
+      * @param steady_start A steady_clock reading, in nanoseconds...
+      * @param wall_start ...and the system_clock reading taken at the same moment.
+      */
+    TraceWriter(const std::string &path, int64_t steady_start, int64_t wall_start) : previous(steady_start) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open trace file " + path);
+        }
+        reserve(INITIAL_SIZE);
+        std::memcpy(map, trace::MAGIC, sizeof(trace::MAGIC));
+        uint8_t *cursor = map + sizeof(trace::MAGIC);
+        cursor = trace::putVarint(cursor, steady_start);
+        cursor = trace::putVarint(cursor, wall_start);
+        length = cursor - map;
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    ~TraceWriter() {
+        close();
+    }
+
+    void append(const LogRecord &record) {
+        if (length + trace::MAX_RECORD_BYTES > capacity) {
+            reserve(capacity * 2);
+        }
+        uint8_t *cursor = map + length;
+        cursor = trace::putVarint(cursor, trace::zigzag(record.timestamp_ns - previous) + 1);
+        cursor = trace::putVarint(cursor, static_cast<uint32_t>(record.philosopher_id));
+        cursor = trace::putVarint(cursor, record.table_id);
+        *cursor++ = static_cast<uint8_t>(record.state | record.action << 2 | (record.flags & LogRecord::CONTINUED) << 6);
+        cursor = trace::putVarint(cursor, record.bottle_count);
+        for (int i = 0; i < record.bottle_count; ++i) {
+            cursor = trace::putVarint(cursor, static_cast<uint32_t>(record.bottles[i]));
+        }
+        length = cursor - map;
+        previous = record.timestamp_ns;
+    }
+
+    void close() {
+        if (fd < 0) {
+            return;
+        }
+        munmap(map, capacity);
+        if (ftruncate(fd, static_cast<off_t>(length)) != 0) {
+            perror("ftruncate");
+        }
+        ::close(fd);
+        fd = -1;
+    }
+
+private:
+    static constexpr size_t INITIAL_SIZE = 1 << 24;
+
+    int fd = -1;
+    uint8_t *map = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    int64_t previous; // Timestamp of the last record, records store the difference
+
+    void reserve(size_t size) {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("cannot grow trace file");
+        }
+        void *grown = map == nullptr ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                     : mremap(map, capacity, size, MREMAP_MAYMOVE);
+        if (grown == MAP_FAILED) {
+            throw std::runtime_error("cannot map trace file");
+        }
+        map = static_cast<uint8_t *>(grown);
+        capacity = size;
+    }
+};
+
+/**
+ * Reads a binary trace file back, record by record, through a read-only mapping.
+ */
+class TraceReader {
+public:
+    explicit TraceReader(const std::string &path) {
+        fd = open(path.c_str(), O_RDONLY);
+        struct stat info{};
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            throw std::runtime_error("cannot open trace file " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        void *mapped = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("cannot map trace file " + path);
+        }
+        begin = static_cast<const uint8_t *>(mapped);
+        end = begin + size;
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        uint64_t steady = 0, wall = 0;
+        cursor = begin + sizeof(trace::MAGIC);
+        if (size < sizeof(trace::MAGIC) || std::memcmp(begin, trace::MAGIC, sizeof(trace::MAGIC)) != 0
+            || (cursor = trace::getVarint(cursor, end, steady)) == nullptr
+            || (cursor = trace::getVarint(cursor, end, wall)) == nullptr) {
+            throw std::runtime_error(path + " is not a drinking philosophers trace");
+        }
+        steady_start = static_cast<int64_t>(steady);
+        wall_start = static_cast<int64_t>(wall);
+        previous = steady_start;
+    }
+
+    TraceReader(const TraceReader &) = delete;
+    TraceReader &operator=(const TraceReader &) = delete;
+
+    ~TraceReader() {
+        munmap(const_cast<uint8_t *>(begin), size);
+        ::close(fd);
+    }
+
+    // Decodes the next record; returns false at the end of the trace or on a truncated record
+    bool next(LogRecord &record) {
+        uint64_t delta, philosopher, table, count;
+        const uint8_t *in = cursor;
+        if (in == end || *in == 0 || (in = trace::getVarint(in, end, delta)) == nullptr
+            || (in = trace::getVarint(in, end, philosopher)) == nullptr
+            || (in = trace::getVarint(in, end, table)) == nullptr || in == end) {
+            return false;
+        }
+        const uint8_t packed = *in++;
+        if ((packed >> 2 & 0xf) > TABLE_FREED || (in = trace::getVarint(in, end, count)) == nullptr ||
+            count > LogRecord::MAX_BOTTLES) {
+            return false;
+        }
+        record = {};
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t bottle;
+            if ((in = trace::getVarint(in, end, bottle)) == nullptr) {
+                return false;
+            }
+            record.bottles[i] = static_cast<int32_t>(bottle);
+        }
+        previous += trace::unzigzag(delta - 1);
+        record.timestamp_ns = previous;
+        record.philosopher_id = static_cast<int32_t>(philosopher);
+        record.table_id = static_cast<uint16_t>(table);
+        record.state = packed & 0x3;
+        record.action = packed >> 2 & 0xf;
+        record.flags = packed >> 6 & LogRecord::CONTINUED;
+        record.bottle_count = static_cast<uint8_t>(count);
+        cursor = in;
+        return true;
+    }
+
+    int64_t steady_start;
+    int64_t wall_start;
+
+private:
+    int fd = -1;
+    size_t size = 0;
+    const uint8_t *begin = nullptr;
+    const uint8_t *end = nullptr;
+    const uint8_t *cursor = nullptr;
+    int64_t previous;
+};
+
+#endif // __philosopher_trace_h__
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "philosopher_trace.h"
+
+/*
+ * Decodes a binary trace written by `drinking_philosopher --trace=<file>`.
+ * By default it prints the same text the simulation logs to stdout; --csv prints one row per record instead,
+ * with the raw nanosecond steady_clock timestamps.
+ */
+
+void usage(const char *program) {
+    std::cerr << "usage: " << program << " [--csv] <trace>\n";
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    bool csv = false;
+    std::string path;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--csv") {
+            csv = true;
+        } else if (path.empty() && !arg.starts_with("--")) {
+            path = arg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (path.empty()) {
+        usage(argv[0]);
+    }
+
+    try {
+        TraceReader reader(path);
+        TraceFormatter formatter(reader.steady_start, reader.wall_start);
+        std::string out;
+        if (csv) {
+            out += TraceFormatter::csvHeader();
+        }
+
+        LogRecord record;
+        while (reader.next(record)) {
+            if (csv) {
+                formatter.csv(record, out);
+            } else {
+                formatter.text(record, out);
+            }
+            if (out.size() >= (1 << 16)) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+        if (formatter.getSkippedTableRecords() > 0) {
+            std::cerr << "skipped " << formatter.getSkippedTableRecords()
+                      << " table records naming a table that was never opened or bottles it does not have\n";
+        }
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
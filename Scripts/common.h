@@ -4,18 +4,118 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
 
-double GetTime() {
-    struct timeval t;
-    int rc = gettimeofday(&t, NULL);
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
+static inline void Cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Nanoseconds on a clock NTP never slews; only differences are meaningful
+static inline uint64_t GetTimeNs(void) {
+    struct timespec t;
+    int rc = clock_gettime(CLOCK_MONOTONIC_RAW, &t);
     assert(rc == 0);
-    return (double) t.tv_sec + (double) t.tv_usec/1e6;
+    return (uint64_t) t.tv_sec * 1000000000 + (uint64_t) t.tv_nsec;
+}
+
+// Raw cycle counter: the TSC on x86, the virtual counter on AArch64, else GetTimeNs()
+static inline uint64_t ReadCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t cycles;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cycles));
+    return cycles;
+#else
+    return GetTimeNs();
+#endif
+}
+
+// Like ReadCycles(), but waits for earlier instructions to finish, for the end of a measured region
+static inline uint64_t ReadCyclesOrdered(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned aux;
+    return __builtin_ia32_rdtscp(&aux);
+#elif defined(__aarch64__)
+    __asm__ __volatile__("isb" ::: "memory");
+    return ReadCycles();
+#else
+    return GetTimeNs();
+#endif
+}
+
+// Calibration of ReadCycles() against GetTimeNs(), done once per program on first use.
+// Call CyclesPerNs() before starting threads to keep the calibration out of anything being measured.
+static double calibrated_cycles_per_ns = -1;
+static uint64_t calibrated_cycles, calibrated_ns;
+
+#define CALIBRATION_NS 10000000
+
+static inline double CyclesPerNs(void) {
+    if (calibrated_cycles_per_ns >= 0)
+        return calibrated_cycles_per_ns;
+    double rate = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    // Only an invariant TSC ticks at a fixed rate across frequency changes and sleep states
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) {
+        uint64_t start_ns = GetTimeNs(), start_cycles = ReadCycles(), ns;
+        while ((ns = GetTimeNs()) - start_ns < CALIBRATION_NS)
+            ;
+        rate = (double) (ReadCycles() - start_cycles) / (double) (ns - start_ns);
+    }
+#elif defined(__aarch64__)
+    uint64_t frequency;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frequency));
+    rate = (double) frequency / 1e9;
+#endif
+    calibrated_ns = GetTimeNs();
+    calibrated_cycles = ReadCycles();
+    calibrated_cycles_per_ns = rate;
+    return rate;
+}
+
+// GetTimeNs() from the cycle counter when it is calibrated, skipping the clock_gettime call
+static inline uint64_t FastTimeNs(void) {
+    double rate = CyclesPerNs();
+    if (rate <= 0)
+        return GetTimeNs();
+    return calibrated_ns + (uint64_t) ((double) (ReadCycles() - calibrated_cycles) / rate);
+}
+
+// Busy-waits for ns nanoseconds, reading the cycle counter between pause hints
+static inline void SpinNs(uint64_t ns) {
+    double rate = CyclesPerNs();
+    if (rate <= 0) {
+        uint64_t start = GetTimeNs();
+        while (GetTimeNs() - start < ns)
+            Cpu_relax();
+        return;
+    }
+    uint64_t start = ReadCycles(), cycles = (uint64_t) ((double) ns * rate);
+    while (ReadCycles() - start < cycles)
+        Cpu_relax();
+}
+
+double GetTime() {
+    return (double) GetTimeNs() / 1e9;
 }
 
 void Spin(int howlong) {
-    double t = GetTime();
-    while ((GetTime() - t) < (double) howlong)
-	; // do nothing in loop
+    SpinNs((uint64_t) howlong * 1000000000);
 }
 
-#endif // __common_h__
\ No newline at end of file
+#endif // __common_h__
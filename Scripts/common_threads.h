@@ -5,8 +5,15 @@
 #include <assert.h>
 #include <sched.h>
 
+#include <stdatomic.h>
+#include <stddef.h>
+#include "common.h" // Cpu_relax()
+
 #ifdef __linux__
 #include <semaphore.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
 #define Pthread_create(thread, attr, start_routine, arg) assert(pthread_create(thread, attr, start_routine, arg) == 0);
@@ -30,4 +37,138 @@
 #define Sem_post(sem)                                    assert(sem_post(sem) == 0);
 #endif // __linux__
 
+// Lock primitives. Each *_unlock asserts that the lock was actually held.
+
+// Test-and-test-and-set spinlock: waiters spin on a plain load and back off exponentially after a failed exchange
+#define SPINLOCK_BACKOFF_MIN 4
+#define SPINLOCK_BACKOFF_MAX 1024
+
+typedef struct {
+    atomic_int locked;
+} spinlock_t;
+
+static inline void Spinlock_init(spinlock_t *l) {
+    atomic_init(&l->locked, 0);
+}
+
+static inline void Spinlock_lock(spinlock_t *l) {
+    unsigned backoff = SPINLOCK_BACKOFF_MIN;
+    while (1) {
+        while (atomic_load_explicit(&l->locked, memory_order_relaxed))
+            Cpu_relax();
+        if (!atomic_exchange_explicit(&l->locked, 1, memory_order_acquire))
+            return;
+        for (unsigned i = 0; i < backoff; i++)
+            Cpu_relax();
+        if (backoff < SPINLOCK_BACKOFF_MAX)
+            backoff *= 2;
+    }
+}
+
+static inline void Spinlock_unlock(spinlock_t *l) {
+    assert(atomic_load_explicit(&l->locked, memory_order_relaxed) == 1);
+    atomic_store_explicit(&l->locked, 0, memory_order_release);
+}
+
+// Ticket lock: FIFO handoff; waiters back off in proportion to how far back in line they are
+typedef struct {
+    atomic_uint next;
+    atomic_uint owner;
+} ticket_lock_t;
+
+static inline void Ticket_init(ticket_lock_t *l) {
+    atomic_init(&l->next, 0);
+    atomic_init(&l->owner, 0);
+}
+
+static inline void Ticket_lock(ticket_lock_t *l) {
+    unsigned ticket = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+    unsigned owner;
+    while ((owner = atomic_load_explicit(&l->owner, memory_order_acquire)) != ticket) {
+        for (unsigned i = 0; i < (ticket - owner) * SPINLOCK_BACKOFF_MIN; i++)
+            Cpu_relax();
+    }
+}
+
+static inline void Ticket_unlock(ticket_lock_t *l) {
+    unsigned owner = atomic_load_explicit(&l->owner, memory_order_relaxed);
+    assert(owner != atomic_load_explicit(&l->next, memory_order_relaxed));
+    atomic_store_explicit(&l->owner, owner + 1, memory_order_release);
+}
+
+// MCS queue lock: each waiter spins on its own node, so a handoff touches one other cache line.
+// The caller supplies the node and passes the same one to lock and unlock.
+typedef struct mcs_node {
+    _Atomic(struct mcs_node *) next;
+    atomic_int waiting;
+} mcs_node_t;
+
+typedef struct {
+    _Atomic(mcs_node_t *) tail;
+} mcs_lock_t;
+
+static inline void Mcs_init(mcs_lock_t *l) {
+    atomic_init(&l->tail, NULL);
+}
+
+static inline void Mcs_lock(mcs_lock_t *l, mcs_node_t *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->waiting, 1, memory_order_relaxed);
+    mcs_node_t *prev = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+    if (prev == NULL)
+        return;
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+    while (atomic_load_explicit(&node->waiting, memory_order_acquire))
+        Cpu_relax();
+}
+
+static inline void Mcs_unlock(mcs_lock_t *l, mcs_node_t *node) {
+    assert(atomic_load_explicit(&l->tail, memory_order_relaxed) != NULL);
+    mcs_node_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+    if (next == NULL) {
+        mcs_node_t *expected = node;
+        if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL, memory_order_release,
+                                                    memory_order_relaxed))
+            return;
+        // A successor swapped itself in but has not linked to us yet
+        while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL)
+            Cpu_relax();
+    }
+    atomic_store_explicit(&next->waiting, 0, memory_order_release);
+}
+
+#ifdef __linux__
+// Adaptive futex mutex: spins briefly, then parks in the kernel.
+// State is 0 when unlocked, 1 when locked, and 2 when locked with possible sleepers.
+#define FUTEX_MUTEX_SPINS 100
+
+typedef struct {
+    atomic_int state;
+} futex_mutex_t;
+
+static inline void Futex_mutex_init(futex_mutex_t *m) {
+    atomic_init(&m->state, 0);
+}
+
+static inline void Futex_mutex_lock(futex_mutex_t *m) {
+    for (int i = 0; i < FUTEX_MUTEX_SPINS; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_weak_explicit(&m->state, &expected, 1, memory_order_acquire,
+                                                  memory_order_relaxed))
+            return;
+        Cpu_relax();
+    }
+    // Whoever takes the lock from here on marks it contended, so the eventual unlock wakes someone
+    while (atomic_exchange_explicit(&m->state, 2, memory_order_acquire) != 0)
+        syscall(SYS_futex, &m->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+}
+
+static inline void Futex_mutex_unlock(futex_mutex_t *m) {
+    int previous = atomic_exchange_explicit(&m->state, 0, memory_order_release);
+    assert(previous != 0);
+    if (previous == 2)
+        syscall(SYS_futex, &m->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#endif // __linux__
+
 #endif // __common_threads_h__
\ No newline at end of file
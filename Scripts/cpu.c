@@ -1,18 +1,259 @@
+#define _GNU_SOURCE // CPU_SET and pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "common.h"
+#include "common_threads.h"
+
+/*
+ * cpu <string> prints the string once a second, forever, spinning in between.
+ *
+ * With options it is a load generator instead: it starts -w workers, each pinned to its own CPU from the
+ * affinity mask, round robin. Each worker is busy for -d percent of every -p millisecond period running one
+ * workload, then sleeps until the next period starts:
+ *   alu     integer arithmetic that stays in registers
+ *   stream  a STREAM-style triad over three -m KiB arrays
+ *   chase   a dependent pointer chase through a -m KiB random cycle of cache lines
+ * After -t seconds it reports, per worker, the duty cycle it actually achieved (its CPU time over wall time),
+ * how much work it got done, and how late each periodic wakeup was.
+ */
+
+#define CACHE_LINE 64
+#define CHUNK 4096 // work between clock reads
+#define MAX_CPUS 1024
+
+typedef enum { ALU, STREAM, CHASE, KINDS } workload_kind;
+
+static const char *kind_names[KINDS] = {"alu", "stream", "chase"};
+
+typedef struct node {
+    struct node *next;
+    char pad[CACHE_LINE - sizeof(struct node *)];
+} node_t;
+
+typedef struct {
+    int id;
+    int cpu;
+    double *a, *b, *c;
+    node_t *nodes;
+    size_t elements;
+    uint64_t *wake_latencies;
+    int wakeups;
+    uint64_t work;
+    uint64_t cpu_ns, wall_ns;
+    uint64_t sink;
+} worker_t;
+
+int workers = 1;
+int duty = 100;
+int period_ms = 10;
+int seconds = 10;
+int kilobytes = 65536;
+workload_kind kind = ALU;
+
+// CPU time this thread has used; wall time comes from GetTimeNs()
+uint64_t thread_cpu_ns(void) {
+    struct timespec t;
+    int rc = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    assert(rc == 0);
+    return (uint64_t) t.tv_sec * 1000000000 + (uint64_t) t.tv_nsec;
+}
+
+// One chunk of the chosen workload; returns units of work done
+uint64_t work_chunk(worker_t *w, size_t *cursor) {
+    switch (kind) {
+    case ALU: {
+        uint64_t x = w->sink | 1;
+        for (int i = 0; i < CHUNK; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+        }
+        w->sink = x;
+        return CHUNK;
+    }
+    case STREAM: {
+        size_t begin = *cursor, end = begin + CHUNK < w->elements ? begin + CHUNK : w->elements;
+        for (size_t i = begin; i < end; i++)
+            w->a[i] = w->b[i] + 3.0 * w->c[i];
+        *cursor = end == w->elements ? 0 : end;
+        return end - begin;
+    }
+    case CHASE: {
+        node_t *p = w->nodes + *cursor;
+        for (int i = 0; i < CHUNK; i++)
+            p = p->next;
+        *cursor = (size_t) (p - w->nodes);
+        return CHUNK;
+    }
+    default:
+        return 0;
+    }
+}
+
+void prepare(worker_t *w) {
+    size_t bytes = (size_t) kilobytes * 1024;
+    if (kind == STREAM) {
+        w->elements = bytes / sizeof(double);
+        w->a = malloc(bytes);
+        w->b = malloc(bytes);
+        w->c = malloc(bytes);
+        assert(w->a != NULL && w->b != NULL && w->c != NULL);
+        for (size_t i = 0; i < w->elements; i++) {
+            w->a[i] = 0;
+            w->b[i] = 1;
+            w->c[i] = 2;
+        }
+    } else if (kind == CHASE) {
+        // Link the lines in a random order (Sattolo's shuffle) so the prefetcher cannot follow
+        w->elements = bytes / sizeof(node_t);
+        w->nodes = aligned_alloc(CACHE_LINE, w->elements * sizeof(node_t));
+        size_t *order = malloc(w->elements * sizeof(size_t));
+        assert(w->nodes != NULL && order != NULL);
+        for (size_t i = 0; i < w->elements; i++)
+            order[i] = i;
+        unsigned seed = (unsigned) w->id + 1;
+        for (size_t i = w->elements - 1; i > 0; i--) {
+            size_t j = (size_t) rand_r(&seed) % i;
+            size_t swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+        for (size_t i = 0; i < w->elements; i++)
+            w->nodes[order[i]].next = &w->nodes[order[(i + 1) % w->elements]];
+        free(order);
+    }
+}
+
+void *worker(void *arg) {
+    worker_t *w = arg;
+#ifdef __linux__
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        assert(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+    }
+#endif
+    prepare(w); // after pinning, so first touch puts the memory near the worker
+
+    uint64_t period = (uint64_t) period_ms * 1000000, busy = period * duty / 100;
+    uint64_t start = GetTimeNs(), end = start + (uint64_t) seconds * 1000000000;
+    uint64_t cpu_start = thread_cpu_ns();
+    size_t cursor = 0;
+    for (uint64_t next = start; next < end; next += period) {
+        uint64_t stop = next + busy < end ? next + busy : end;
+        while (GetTimeNs() < stop)
+            w->work += work_chunk(w, &cursor);
+        if (busy == period)
+            continue;
+        // Sleep to the start of the next period and record how late the kernel woke us. clock_nanosleep cannot
+        // wait on GetTimeNs()'s raw clock, so the deadline is turned into a relative sleep and rechecked
+        uint64_t wake = next + period;
+        if (wake >= end)
+            break;
+        for (uint64_t now = GetTimeNs(); now < wake; now = GetTimeNs()) {
+            struct timespec t = {(time_t) ((wake - now) / 1000000000), (long) ((wake - now) % 1000000000)};
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &t, NULL);
+        }
+        uint64_t now = GetTimeNs();
+        w->wake_latencies[w->wakeups++] = now > wake ? now - wake : 0;
+    }
+    w->cpu_ns = thread_cpu_ns() - cpu_start;
+    w->wall_ns = GetTimeNs() - start;
+    return NULL;
+}
+
+int compare(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *) x, b = *(const uint64_t *) y;
+    return (a > b) - (a < b);
+}
+
+uint64_t percentile(const uint64_t *sorted, int count, double p) {
+    return count == 0 ? 0 : sorted[(int) (p * (count - 1))];
+}
+
+void usage() {
+    fprintf(stderr, "usage: cpu <string>\n"
+                    "       cpu [-w workers] [-d duty%%] [-p period_ms] [-k alu|stream|chase] [-m KiB] [-t seconds]\n");
+    exit(1);
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "usage: cpu <string>\n");
-        exit(1);
+    if (argc == 2 && argv[1][0] != '-') {
+        char *str = argv[1];
+        while (1) {
+            printf("%s\n", str);
+            Spin(1);
+        }
+    }
+
+    int c;
+    while ((c = getopt(argc, argv, "w:d:p:k:m:t:")) != -1) {
+        switch (c) {
+        case 'w': workers = atoi(optarg); break;
+        case 'd': duty = atoi(optarg); break;
+        case 'p': period_ms = atoi(optarg); break;
+        case 'm': kilobytes = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'k':
+            kind = KINDS;
+            for (int k = 0; k < KINDS; k++)
+                if (strcmp(optarg, kind_names[k]) == 0)
+                    kind = k;
+            if (kind == KINDS)
+                usage();
+            break;
+        default: usage();
+        }
+    }
+    if (optind != argc || argc == 1 || workers < 1 || duty < 1 || duty > 100 || period_ms < 1 || seconds < 1 ||
+        kilobytes < 1)
+        usage();
+
+    int cpus[MAX_CPUS], number_of_cpus = 0;
+#ifdef __linux__
+    cpu_set_t allowed;
+    assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    for (int cpu = 0; cpu < CPU_SETSIZE && number_of_cpus < MAX_CPUS; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[number_of_cpus++] = cpu;
+#endif
+
+    worker_t *w = calloc(workers, sizeof(worker_t));
+    pthread_t *p = malloc(sizeof(pthread_t) * workers);
+    assert(w != NULL && p != NULL);
+    int periods = (int) ((uint64_t) seconds * 1000 / period_ms) + 1;
+    for (int i = 0; i < workers; i++) {
+        w[i].id = i;
+        w[i].cpu = number_of_cpus > 0 ? cpus[i % number_of_cpus] : -1;
+        w[i].wake_latencies = malloc(sizeof(uint64_t) * periods);
+        assert(w[i].wake_latencies != NULL);
+        Pthread_create(&p[i], NULL, worker, &w[i]);
+    }
+    for (int i = 0; i < workers; i++) {
+        Pthread_join(p[i], NULL);
     }
-    char *str = argv[1];
 
-    while (1) {
-        printf("%s\n", str);
-        Spin(1);
+    printf("%-6s %4s %-6s %6s %9s %14s %9s %9s %9s\n", "worker", "cpu", "kind", "duty", "achieved", "work/sec",
+           "wake_p50", "wake_p99", "wake_max");
+    for (int i = 0; i < workers; i++) {
+        qsort(w[i].wake_latencies, w[i].wakeups, sizeof(uint64_t), compare);
+        double wall = (double) w[i].wall_ns;
+        printf("%-6d %4d %-6s %5d%% %8.1f%% %14.0f %7.1fus %7.1fus %7.1fus\n", i, w[i].cpu, kind_names[kind], duty,
+               100.0 * (double) w[i].cpu_ns / wall, (double) w[i].work * 1e9 / wall,
+               percentile(w[i].wake_latencies, w[i].wakeups, 0.5) / 1e3,
+               percentile(w[i].wake_latencies, w[i].wakeups, 0.99) / 1e3,
+               (w[i].wakeups ? w[i].wake_latencies[w[i].wakeups - 1] : 0) / 1e3);
+        free(w[i].wake_latencies);
+        free(w[i].a);
+        free(w[i].b);
+        free(w[i].c);
+        free(w[i].nodes);
     }
+    free(w);
+    free(p);
     return 0;
-}
\ No newline at end of file
+}
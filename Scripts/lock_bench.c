@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "common.h"
+#include "common_threads.h"
+
+/*
+ * Lock microbenchmark for the primitives in common_threads.h, with pthread_mutex_t as the baseline.
+ * For every lock, thread count (1, 2, 4, ... up to -t) and critical-section length (-c, in Cpu_relax() calls),
+ * all threads acquire, do the critical section and release for -d seconds. It prints throughput and the
+ * acquire+release latency percentiles, measured around each operation with FastTimeNs().
+ */
+
+#define CACHE_LINE 64
+#define BUCKETS 496
+
+typedef enum { PTHREAD, SPIN, TICKET, MCS, FUTEX, LOCKS } lock_kind;
+
+static const char *lock_names[LOCKS] = {"pthread", "ttas", "ticket", "mcs", "futex"};
+
+typedef struct {
+    _Alignas(CACHE_LINE) uint64_t ops;
+    uint64_t histogram[BUCKETS];
+} worker_t;
+
+pthread_mutex_t pthread_lock = PTHREAD_MUTEX_INITIALIZER;
+spinlock_t spin_lock;
+ticket_lock_t ticket_lock;
+mcs_lock_t mcs_lock;
+#ifdef __linux__
+futex_mutex_t futex_lock;
+#endif
+
+lock_kind kind;
+int critical_section;
+_Alignas(CACHE_LINE) atomic_int stop;
+_Alignas(CACHE_LINE) uint64_t shared; // only touched under the lock
+pthread_barrier_t start;
+
+// Log-linear buckets: exact below 8ns, then 8 per power of two
+int bucket_of(uint64_t ns) {
+    if (ns < 8)
+        return (int) ns;
+    int log = 63 - __builtin_clzll(ns);
+    return (log - 2) * 8 + (int) ((ns >> (log - 3)) & 7);
+}
+
+uint64_t lowest_in(int bucket) {
+    if (bucket < 8)
+        return (uint64_t) bucket;
+    return (uint64_t) (8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+uint64_t percentile(const uint64_t *histogram, uint64_t total, double p) {
+    uint64_t rank = (uint64_t) (p * (double) total), seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen > rank)
+            return lowest_in(b);
+    }
+    return lowest_in(BUCKETS - 1);
+}
+
+void *worker(void *arg) {
+    worker_t *self = arg;
+    mcs_node_t node;
+    pthread_barrier_wait(&start);
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        uint64_t begin = FastTimeNs();
+        switch (kind) {
+        case PTHREAD: Pthread_mutex_lock(&pthread_lock); break;
+        case SPIN: Spinlock_lock(&spin_lock); break;
+        case TICKET: Ticket_lock(&ticket_lock); break;
+        case MCS: Mcs_lock(&mcs_lock, &node); break;
+#ifdef __linux__
+        case FUTEX: Futex_mutex_lock(&futex_lock); break;
+#endif
+        default: break;
+        }
+        shared++;
+        for (int i = 0; i < critical_section; i++)
+            Cpu_relax();
+        switch (kind) {
+        case PTHREAD: Pthread_mutex_unlock(&pthread_lock); break;
+        case SPIN: Spinlock_unlock(&spin_lock); break;
+        case TICKET: Ticket_unlock(&ticket_lock); break;
+        case MCS: Mcs_unlock(&mcs_lock, &node); break;
+#ifdef __linux__
+        case FUTEX: Futex_mutex_unlock(&futex_lock); break;
+#endif
+        default: break;
+        }
+        self->histogram[bucket_of(FastTimeNs() - begin)]++;
+        self->ops++;
+    }
+    return NULL;
+}
+
+void run(lock_kind which, int threads, int length, double seconds) {
+    kind = which;
+    critical_section = length;
+    shared = 0;
+    atomic_store(&stop, 0);
+
+    worker_t *workers = aligned_alloc(CACHE_LINE, sizeof(worker_t) * threads);
+    pthread_t *p = malloc(sizeof(pthread_t) * threads);
+    assert(workers != NULL && p != NULL);
+    memset(workers, 0, sizeof(worker_t) * threads);
+    assert(pthread_barrier_init(&start, NULL, threads + 1) == 0);
+    for (int i = 0; i < threads; i++) {
+        Pthread_create(&p[i], NULL, worker, &workers[i]);
+    }
+    double t = GetTime();
+    pthread_barrier_wait(&start);
+    usleep((useconds_t) (seconds * 1e6));
+    atomic_store(&stop, 1);
+    for (int i = 0; i < threads; i++) {
+        Pthread_join(p[i], NULL);
+    }
+    double elapsed = GetTime() - t;
+    pthread_barrier_destroy(&start);
+
+    uint64_t histogram[BUCKETS] = {0}, ops = 0;
+    for (int i = 0; i < threads; i++) {
+        ops += workers[i].ops;
+        for (int b = 0; b < BUCKETS; b++)
+            histogram[b] += workers[i].histogram[b];
+    }
+    assert(shared == ops); // the lock lost no updates
+    printf("%-8s %8d %8d %14.0f %10lu %10lu %10lu\n", lock_names[which], threads, length, ops / elapsed,
+           (unsigned long) percentile(histogram, ops, 0.5), (unsigned long) percentile(histogram, ops, 0.99),
+           (unsigned long) percentile(histogram, ops, 0.999));
+    free(workers);
+    free(p);
+}
+
+void usage() {
+    fprintf(stderr, "usage: lock_bench [-t max_threads] [-c cs_length,...] [-d seconds] [-l lock,...]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    char lengths_arg[256] = "0,50,500";
+    char locks_arg[256] = "pthread,ttas,ticket,mcs,futex";
+    double seconds = 0.2;
+    int c;
+    while ((c = getopt(argc, argv, "t:c:d:l:")) != -1) {
+        switch (c) {
+        case 't': max_threads = atoi(optarg); break;
+        case 'c': snprintf(lengths_arg, sizeof(lengths_arg), "%s", optarg); break;
+        case 'd': seconds = atof(optarg); break;
+        case 'l': snprintf(locks_arg, sizeof(locks_arg), "%s", optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc || max_threads < 1 || seconds <= 0)
+        usage();
+
+    int lengths[64], number_of_lengths = 0;
+    for (char *token = strtok(lengths_arg, ","); token && number_of_lengths < 64; token = strtok(NULL, ","))
+        lengths[number_of_lengths++] = atoi(token);
+    int locks[LOCKS], number_of_locks = 0;
+    for (char *token = strtok(locks_arg, ","); token; token = strtok(NULL, ",")) {
+        int found = -1;
+        for (int k = 0; k < LOCKS; k++)
+            if (strcmp(token, lock_names[k]) == 0)
+                found = k;
+#ifndef __linux__
+        if (found == FUTEX)
+            found = -1;
+#endif
+        if (found < 0 || number_of_locks == LOCKS)
+            usage();
+        locks[number_of_locks++] = found;
+    }
+
+    CyclesPerNs(); // calibrate before any thread takes a timestamp
+    Spinlock_init(&spin_lock);
+    Ticket_init(&ticket_lock);
+    Mcs_init(&mcs_lock);
+#ifdef __linux__
+    Futex_mutex_init(&futex_lock);
+#endif
+
+    printf("%-8s %8s %8s %14s %10s %10s %10s\n", "lock", "threads", "cs", "ops/sec", "p50_ns", "p99_ns", "p999_ns");
+    for (int k = 0; k < number_of_locks; k++) {
+        for (int l = 0; l < number_of_lengths; l++) {
+            for (int threads = 1;; threads *= 2) {
+                if (threads > max_threads)
+                    threads = max_threads;
+                run(locks[k], threads, lengths[l], seconds);
+                if (threads == max_threads)
+                    break;
+            }
+        }
+    }
+    return 0;
+}
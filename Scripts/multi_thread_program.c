@@ -1,31 +1,190 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "common.h"
 #include "common_threads.h"
 
-volatile int counter = 0; 
+/*
+ * Every thread adds 1 to a shared counter <loops> times, using one of these strategies:
+ *   racy       counter++ on a volatile, which loses updates
+ *   mutex      counter++ under one pthread mutex
+ *   atomic     one atomic fetch-add per increment, every thread on the same cache line
+ *   sharded    each thread increments its own cache-line-padded shard; shards are summed after join
+ *   combining  flat combining: threads publish requests and whoever holds the combiner lock applies them all
+ * "all" runs every mode in turn. Each run reports the final value against the expected one, and ops/sec.
+ */
+
+#define CACHE_LINE 64
+
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_long value;
+} shard_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int pending;
+} request_t;
+
+typedef enum { RACY, MUTEX, ATOMIC, SHARDED, COMBINING, MODES } counter_mode;
+
+static const char *mode_names[MODES] = {"racy", "mutex", "atomic", "sharded", "combining"};
+
+volatile long counter = 0;
 int loops;
+int threads;
+counter_mode mode;
+
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+_Alignas(CACHE_LINE) atomic_long shared = 0;
+shard_t *shards;
+
+// Flat combining state: one request slot per thread, and the lock whose holder serves them
+request_t *requests;
+_Alignas(CACHE_LINE) atomic_int combiner = 0;
+long combined = 0; // only touched while holding combiner
+
+pthread_barrier_t start;
+
+void combining_increment(int id) {
+    atomic_store_explicit(&requests[id].pending, 1, memory_order_release);
+    int spins = 0;
+    while (atomic_load_explicit(&requests[id].pending, memory_order_acquire)) {
+        if (atomic_load_explicit(&combiner, memory_order_relaxed) == 0 &&
+            atomic_exchange_explicit(&combiner, 1, memory_order_acquire) == 0) {
+            for (int i = 0; i < threads; i++) {
+                if (atomic_load_explicit(&requests[i].pending, memory_order_acquire)) {
+                    combined++;
+                    atomic_store_explicit(&requests[i].pending, 0, memory_order_release);
+                }
+            }
+            atomic_store_explicit(&combiner, 0, memory_order_release);
+        } else if (++spins % 128 == 0) {
+            sched_yield(); // with more threads than CPUs the combiner may be descheduled
+        }
+    }
+}
 
 void *worker(void *arg) {
+    int id = (int) (long) arg;
     int i;
-    for (i = 0; i < loops; i++) {
-	    counter++;
+    pthread_barrier_wait(&start);
+    switch (mode) {
+    case RACY:
+        for (i = 0; i < loops; i++) {
+            counter++;
+        }
+        break;
+    case MUTEX:
+        for (i = 0; i < loops; i++) {
+            Pthread_mutex_lock(&lock);
+            counter++;
+            Pthread_mutex_unlock(&lock);
+        }
+        break;
+    case ATOMIC:
+        for (i = 0; i < loops; i++) {
+            atomic_fetch_add_explicit(&shared, 1, memory_order_relaxed);
+        }
+        break;
+    case SHARDED:
+        // Only this thread writes its shard, so a plain load and store does without a locked instruction
+        for (i = 0; i < loops; i++) {
+            long value = atomic_load_explicit(&shards[id].value, memory_order_relaxed);
+            atomic_store_explicit(&shards[id].value, value + 1, memory_order_relaxed);
+        }
+        break;
+    case COMBINING:
+        for (i = 0; i < loops; i++) {
+            combining_increment(id);
+        }
+        break;
+    default:
+        break;
     }
     return NULL;
 }
 
+long run(counter_mode which, double *elapsed) {
+    mode = which;
+    counter = 0;
+    atomic_store(&shared, 0);
+    combined = 0;
+    for (int i = 0; i < threads; i++) {
+        atomic_store(&shards[i].value, 0);
+        atomic_store(&requests[i].pending, 0);
+    }
+
+    pthread_t *p = malloc(sizeof(pthread_t) * threads);
+    assert(p != NULL);
+    assert(pthread_barrier_init(&start, NULL, threads + 1) == 0);
+    for (int i = 0; i < threads; i++) {
+        Pthread_create(&p[i], NULL, worker, (void *) (long) i);
+    }
+    // Start the clock before releasing the workers: on a busy machine they may finish before main runs again
+    double t = GetTime();
+    pthread_barrier_wait(&start);
+    for (int i = 0; i < threads; i++) {
+        Pthread_join(p[i], NULL);
+    }
+    *elapsed = GetTime() - t;
+    pthread_barrier_destroy(&start);
+    free(p);
+
+    switch (which) {
+    case ATOMIC:
+        return atomic_load(&shared);
+    case SHARDED: {
+        long total = 0;
+        for (int i = 0; i < threads; i++) {
+            total += atomic_load(&shards[i].value);
+        }
+        return total;
+    }
+    case COMBINING:
+        return combined;
+    default:
+        return counter;
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) { 
-        fprintf(stderr, "usage: threads <loops>\n"); 
-        exit(1); 
-    } 
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: threads <loops> [threads] [racy|mutex|atomic|sharded|combining|all]\n");
+        exit(1);
+    }
     loops = atoi(argv[1]);
-    pthread_t p1, p2;
-    printf("Initial value : %d\n", counter);
-    Pthread_create(&p1, NULL, worker, NULL); 
-    Pthread_create(&p2, NULL, worker, NULL);
-    Pthread_join(p1, NULL);
-    Pthread_join(p2, NULL);
-    printf("Final value   : %d\n", counter);
+    threads = argc > 2 ? atoi(argv[2]) : 2;
+    const char *name = argc > 3 ? argv[3] : "racy";
+    int first = -1, last = -1;
+    if (strcmp(name, "all") == 0) {
+        first = 0;
+        last = MODES - 1;
+    } else {
+        for (int m = 0; m < MODES; m++) {
+            if (strcmp(name, mode_names[m]) == 0) {
+                first = last = m;
+            }
+        }
+    }
+    if (loops < 0 || threads < 1 || first < 0) {
+        fprintf(stderr, "usage: threads <loops> [threads] [racy|mutex|atomic|sharded|combining|all]\n");
+        exit(1);
+    }
+
+    shards = aligned_alloc(CACHE_LINE, sizeof(shard_t) * threads);
+    requests = aligned_alloc(CACHE_LINE, sizeof(request_t) * threads);
+    assert(shards != NULL && requests != NULL);
+
+    long expected = (long) loops * threads;
+    printf("%-10s %8s %14s %14s %14s\n", "mode", "threads", "final", "expected", "ops/sec");
+    for (int m = first; m <= last; m++) {
+        double elapsed;
+        long value = run(m, &elapsed);
+        printf("%-10s %8d %14ld %14ld %14.0f\n", mode_names[m], threads, value, expected,
+               elapsed > 0 ? expected / elapsed : 0);
+    }
+
+    free(shards);
+    free(requests);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,329 @@
+#define _GNU_SOURCE // splice() and tee()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "common.h"
+
+/*
+ * Pre-forked worker pool: p4.c without a fork and exec per job.
+ * Reads jobs from stdin, one per line:
+ *   <output file> wc <file>        counts lines, words and bytes like wc(1)
+ *   <output file> echo <text>      prints the text
+ *   <output file> exec <cmd> ...   forks and execs cmd, for anything that is not built in
+ * Each of the -w workers is forked once and gets jobs over its own socketpair. A worker's stdout is a pipe,
+ * and the parent moves whatever arrives on it into the job's output file with splice(), so no job output
+ * passes through user space. With -v the output is also tee()d to the pool's own stdout.
+ */
+
+#define JOB_TEXT 1024
+#define SPLICE_CHUNK (1 << 16)
+
+typedef struct {
+    char kind[16];
+    char args[JOB_TEXT];
+} job_t;
+
+typedef struct {
+    pid_t pid;
+    int control;      // socketpair end: jobs go out, statuses come back
+    int capture;      // read end of the worker's stdout pipe
+    int destination;  // output file of the running job, or -1 while idle
+    char line[JOB_TEXT];
+} worker_t;
+
+typedef struct {
+    worker_t *workers;
+    int size;
+    int mirror[2]; // with -v: the pipe tee() copies into on its way to stdout
+    int failed;
+} pool_t;
+
+// --- Worker side -----------------------------------------------------------------------------------------------
+
+int job_wc(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "wc: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    long lines = 0, words = 0, bytes = 0;
+    int c, in_word = 0;
+    while ((c = getc(file)) != EOF) {
+        bytes++;
+        if (c == '\n')
+            lines++;
+        if (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+            in_word = 0;
+        } else if (!in_word) {
+            in_word = 1;
+            words++;
+        }
+    }
+    fclose(file);
+    printf(" %ld %ld %ld %s\n", lines, words, bytes, path);
+    return 0;
+}
+
+int job_exec(char *args) {
+    char *argv[64];
+    int argc = 0;
+    for (char *token = strtok(args, " "); token && argc < 63; token = strtok(NULL, " "))
+        argv[argc++] = token;
+    argv[argc] = NULL;
+    if (argc == 0)
+        return 1;
+    pid_t pid = fork();
+    if (pid < 0)
+        return 1;
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int run_job(job_t *job) {
+    int status = 1;
+    if (strcmp(job->kind, "wc") == 0)
+        status = job_wc(job->args);
+    else if (strcmp(job->kind, "echo") == 0)
+        status = printf("%s\n", job->args) < 0;
+    else if (strcmp(job->kind, "exec") == 0)
+        status = job_exec(job->args);
+    else
+        fprintf(stderr, "unknown job kind %s\n", job->kind);
+    fflush(stdout);
+    return status;
+}
+
+void worker_loop(int control) {
+    job_t job;
+    while (read(control, &job, sizeof(job)) == sizeof(job)) {
+        int status = run_job(&job);
+        if (write(control, &status, sizeof(status)) != sizeof(status))
+            break;
+    }
+    _exit(0);
+}
+
+// --- Pool side -------------------------------------------------------------------------------------------------
+
+// Moves what the worker has written so far into the job's file, without blocking
+void drain(pool_t *pool, worker_t *w) {
+    while (1) {
+        ssize_t n;
+        if (pool->mirror[0] >= 0) {
+            n = tee(w->capture, pool->mirror[1], SPLICE_CHUNK, SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                for (ssize_t left = n, moved; left > 0; left -= moved) {
+                    moved = splice(pool->mirror[0], NULL, STDOUT_FILENO, NULL, left, SPLICE_F_MOVE);
+                    if (moved <= 0) {
+                        perror("splice to stdout");
+                        exit(1);
+                    }
+                }
+                n = splice(w->capture, NULL, w->destination, NULL, n, SPLICE_F_MOVE);
+            }
+        } else {
+            n = splice(w->capture, NULL, w->destination, NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        if (n > 0)
+            continue;
+        if (n < 0 && errno != EAGAIN) {
+            perror("splice");
+            exit(1);
+        }
+        return;
+    }
+}
+
+void pool_init(pool_t *pool, int size, int mirror) {
+    pool->size = size;
+    pool->failed = 0;
+    pool->mirror[0] = pool->mirror[1] = -1;
+    if (mirror)
+        assert(pipe(pool->mirror) == 0);
+    pool->workers = calloc(size, sizeof(worker_t));
+    assert(pool->workers != NULL);
+    fflush(stdout);
+    for (int i = 0; i < size; i++) {
+        worker_t *w = &pool->workers[i];
+        int control[2], capture[2];
+        assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, control) == 0);
+        assert(pipe(capture) == 0);
+        w->pid = fork();
+        if (w->pid < 0) {
+            fprintf(stderr, "fork failed\n");
+            exit(1);
+        } else if (w->pid == 0) {
+            /*
+             * worker: stdin is the job stream, which only the parent may read, so the worker and whatever exec job
+             * it forks read /dev/null instead. stdout becomes the capture pipe, and nothing of the parent's stays
+             * open. Job output can only go to fd 1 (or stderr): the control socket is none of 0-2, which the shell
+             * leaves open, and it is close-on-exec, so exec'd commands never hold it at all.
+             */
+            int null = open("/dev/null", O_RDONLY);
+            assert(null >= 0);
+            dup2(null, STDIN_FILENO);
+            close(null);
+            dup2(capture[1], STDOUT_FILENO);
+            close(capture[0]);
+            close(capture[1]);
+            close(control[0]);
+            for (int j = 0; j < i; j++) {
+                close(pool->workers[j].control);
+                close(pool->workers[j].capture);
+            }
+            if (mirror) {
+                close(pool->mirror[0]);
+                close(pool->mirror[1]);
+            }
+            worker_loop(control[1]);
+        }
+        close(control[1]);
+        close(capture[1]);
+        fcntl(capture[0], F_SETFL, O_NONBLOCK);
+        w->control = control[0];
+        w->capture = capture[0];
+        w->destination = -1;
+    }
+}
+
+// Waits until some busy worker finishes its job, moving output as it arrives; returns that worker
+worker_t *pool_wait_one(pool_t *pool) {
+    struct pollfd fds[2 * pool->size];
+    while (1) {
+        int n = 0;
+        for (int i = 0; i < pool->size; i++) {
+            // poll() skips negative descriptors, which leaves idle workers out
+            int busy = pool->workers[i].destination >= 0;
+            fds[n++] = (struct pollfd) {busy ? pool->workers[i].control : -1, POLLIN, 0};
+            fds[n++] = (struct pollfd) {busy ? pool->workers[i].capture : -1, POLLIN, 0};
+        }
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        for (int i = 0; i < pool->size; i++) {
+            worker_t *w = &pool->workers[i];
+            if (fds[2 * i + 1].revents)
+                drain(pool, w);
+            if (fds[2 * i].revents) {
+                int status;
+                if (read(w->control, &status, sizeof(status)) != sizeof(status)) {
+                    fprintf(stderr, "worker %d died\n", (int) w->pid);
+                    exit(1);
+                }
+                // The status was written after the output, so one more drain gets the rest of it
+                drain(pool, w);
+                close(w->destination);
+                w->destination = -1;
+                if (status != 0) {
+                    fprintf(stderr, "job \"%s\" failed with status %d\n", w->line, status);
+                    pool->failed++;
+                }
+                return w;
+            }
+        }
+    }
+}
+
+// Hands a job to an idle worker, first waiting for one if all are busy; returns 0 if the job was rejected
+int pool_submit(pool_t *pool, const char *output, const char *kind, const char *args, const char *line) {
+    job_t job;
+    if (strlen(kind) >= sizeof(job.kind) || strlen(args) >= sizeof(job.args))
+        return 0;
+    worker_t *w = NULL;
+    for (int i = 0; i < pool->size && w == NULL; i++)
+        if (pool->workers[i].destination < 0)
+            w = &pool->workers[i];
+    if (w == NULL)
+        w = pool_wait_one(pool);
+
+    w->destination = open(output, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (w->destination < 0) {
+        perror(output);
+        return 0;
+    }
+    memset(&job, 0, sizeof(job));
+    strcpy(job.kind, kind);
+    strcpy(job.args, args);
+    snprintf(w->line, sizeof(w->line), "%s", line);
+    assert(write(w->control, &job, sizeof(job)) == sizeof(job));
+    return 1;
+}
+
+void pool_destroy(pool_t *pool) {
+    int busy = 0;
+    for (int i = 0; i < pool->size; i++)
+        busy += pool->workers[i].destination >= 0;
+    for (; busy > 0; busy--)
+        pool_wait_one(pool);
+    for (int i = 0; i < pool->size; i++) {
+        close(pool->workers[i].control); // the worker's read sees EOF and it exits
+        close(pool->workers[i].capture);
+        assert(waitpid(pool->workers[i].pid, NULL, 0) == pool->workers[i].pid);
+    }
+    if (pool->mirror[0] >= 0) {
+        close(pool->mirror[0]);
+        close(pool->mirror[1]);
+    }
+    free(pool->workers);
+}
+
+void usage() {
+    fprintf(stderr, "usage: prefork_pool [-w workers] [-v] < jobs\n"
+                    "       where each job line is: <output file> wc|echo|exec [args...]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = (int) sysconf(_SC_NPROCESSORS_ONLN), mirror = 0;
+    int c;
+    while ((c = getopt(argc, argv, "w:v")) != -1) {
+        switch (c) {
+        case 'w': workers = atoi(optarg); break;
+        case 'v': mirror = 1; break;
+        default: usage();
+        }
+    }
+    if (optind != argc || workers < 1)
+        usage();
+
+    pool_t pool;
+    pool_init(&pool, workers, mirror);
+    uint64_t start = GetTimeNs();
+    int jobs = 0, rejected = 0;
+    char line[JOB_TEXT + 64];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char copy[sizeof(line)];
+        snprintf(copy, sizeof(copy), "%s", line);
+        char *rest = copy;
+        char *output = strsep(&rest, " ");
+        char *kind = rest ? strsep(&rest, " ") : NULL;
+        if (output == NULL || *output == '\0')
+            continue;
+        if (kind == NULL || !pool_submit(&pool, output, kind, rest ? rest : "", line)) {
+            fprintf(stderr, "rejected job \"%s\"\n", line);
+            rejected++;
+            continue;
+        }
+        jobs++;
+    }
+    pool_destroy(&pool);
+    double elapsed = (double) (GetTimeNs() - start) / 1e9;
+    fprintf(stderr, "%d jobs on %d workers in %.3f s (%.0f jobs/sec), %d failed, %d rejected\n", jobs, workers,
+            elapsed, elapsed > 0 ? jobs / elapsed : 0, pool.failed, rejected);
+    return pool.failed || rejected ? 1 : 0;
+}
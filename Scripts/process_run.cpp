@@ -0,0 +1,1298 @@
+// Native port of process_run.py: the same options, process descriptions and SWITCH_ON_*/IO_RUN_* policies, and the
+// same programs for the same seed. Programs are stored run-length encoded, so "compute 1000000" is one entry.
+// --sweep runs a grid of configurations across all cores and prints aggregated CPU and IO utilization.
+//   g++ -std=c++20 -O2 -pthread process_run.cpp -o process_run
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * MT19937 seeded and drawn the way CPython's random module does it, so -l programs match the Python ones
+ */
+class PythonRandom {
+public:
+    explicit PythonRandom(uint64_t seed) {
+        // random.seed(n) feeds abs(n) to init_by_array() as little-endian 32-bit words
+        std::vector<uint32_t> key;
+        do {
+            key.push_back(static_cast<uint32_t>(seed));
+            seed >>= 32;
+        } while (seed != 0);
+        initByArray(key);
+    }
+
+    // random.random(): 53 random bits in [0, 1)
+    double random() {
+        const uint32_t a = next() >> 5, b = next() >> 6;
+        return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    static constexpr int N = 624;
+    static constexpr int M = 397;
+    uint32_t mt[N];
+    int index = N;
+
+    void initGenrand(uint32_t seed) {
+        mt[0] = seed;
+        for (int i = 1; i < N; ++i) {
+            mt[i] = 1812433253u * (mt[i - 1] ^ (mt[i - 1] >> 30)) + i;
+        }
+        index = N;
+    }
+
+    void initByArray(const std::vector<uint32_t> &key) {
+        initGenrand(19650218u);
+        int i = 1, j = 0;
+        const int length = static_cast<int>(key.size());
+        for (int k = std::max(N, length); k > 0; --k) {
+            mt[i] = (mt[i] ^ ((mt[i - 1] ^ (mt[i - 1] >> 30)) * 1664525u)) + key[j] + j;
+            if (++i >= N) {
+                mt[0] = mt[N - 1];
+                i = 1;
+            }
+            if (++j >= length) {
+                j = 0;
+            }
+        }
+        for (int k = N - 1; k > 0; --k) {
+            mt[i] = (mt[i] ^ ((mt[i - 1] ^ (mt[i - 1] >> 30)) * 1566083941u)) - i;
+            if (++i >= N) {
+                mt[0] = mt[N - 1];
+                i = 1;
+            }
+        }
+        mt[0] = 0x80000000u;
+    }
+
+    uint32_t next() {
+        if (index >= N) {
+            for (int k = 0; k < N; ++k) {
+                const uint32_t y = (mt[k] & 0x80000000u) | (mt[(k + 1) % N] & 0x7fffffffu);
+                mt[k] = mt[(k + M) % N] ^ (y >> 1) ^ ((y & 1) ? 0x9908b0dfu : 0);
+            }
+            index = 0;
+        }
+        uint32_t y = mt[index++];
+        y ^= y >> 11;
+        y ^= (y << 7) & 0x9d2c5680u;
+        y ^= (y << 15) & 0xefc60000u;
+        y ^= y >> 18;
+        return y;
+    }
+};
+
+enum Op : uint8_t { DO_COMPUTE, DO_IO };
+
+enum State : uint8_t { STATE_RUNNING, STATE_READY, STATE_DONE, STATE_WAIT };
+
+static const char *OP_NAMES[] = {"cpu", "io"};
+static const char *STATE_NAMES[] = {"RUNNING", "READY", "DONE", "WAITING"};
+
+enum SwitchBehavior { SWITCH_ON_IO, SWITCH_ON_END };
+enum IoDoneBehavior { IO_RUN_LATER, IO_RUN_IMMEDIATE };
+
+/**
+ * A program as runs of the same instruction
+ */
+struct Program {
+    struct Run {
+        Op op;
+        uint32_t count;
+    };
+    std::vector<Run> runs;
+    uint32_t weight = 1; // tickets, stride or CFS share relative to the other processes
+
+    void append(Op op, uint32_t count = 1) {
+        if (count == 0) {
+            return;
+        }
+        if (!runs.empty() && runs.back().op == op) {
+            runs.back().count += count;
+        } else {
+            runs.push_back({op, count});
+        }
+    }
+
+    /**
+     * X:Y from -l: X instructions, each one CPU with Y percent chance and IO otherwise.
+     * An optional third field, X:Y:W, gives the process weight W for the weighted policies.
+     * @return false if the description is malformed.
+     */
+    static bool describe(const std::string &description, PythonRandom &random, Program &program,
+                         int cpu_override = -1) {
+        const auto colon = description.find(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        const auto second = description.find(':', colon + 1);
+        const std::string count = description.substr(0, colon);
+        const std::string percent = description.substr(colon + 1, second == std::string::npos ? second
+                                                                                             : second - colon - 1);
+        const std::string weight = second == std::string::npos ? "1" : description.substr(second + 1);
+        char *count_end, *percent_end, *weight_end;
+        const long instructions = std::strtol(count.c_str(), &count_end, 10);
+        const double given = std::strtod(percent.c_str(), &percent_end);
+        program.weight = static_cast<uint32_t>(std::strtoul(weight.c_str(), &weight_end, 10));
+        if (count.empty() || *count_end != '\0' || percent.empty() || *percent_end != '\0' || weight.empty() ||
+            *weight_end != '\0' || program.weight == 0) {
+            return false;
+        }
+        const double chance_cpu = (cpu_override >= 0 ? cpu_override : given) / 100.0;
+        for (long i = 0; i < instructions; ++i) {
+            program.append(random.random() < chance_cpu ? DO_COMPUTE : DO_IO);
+        }
+        return true;
+    }
+
+    /**
+     * A program file: "compute N" and "io" lines, as load_file() reads them
+     */
+    static bool load(const std::string &path, Program &program) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream words(line);
+            std::string opcode;
+            if (!(words >> opcode)) {
+                continue;
+            }
+            if (opcode == "compute") {
+                uint32_t count;
+                if (!(words >> count)) {
+                    return false;
+                }
+                program.append(DO_COMPUTE, count);
+            } else if (opcode == "io") {
+                program.append(DO_IO);
+            }
+        }
+        return true;
+    }
+};
+
+struct Stats {
+    uint64_t cpu_busy = 0;
+    uint64_t io_busy = 0;
+    uint64_t clock_tick = 0;
+    double mean_turnaround = 0;
+    double mean_response = 0;
+    double fairness = 1;
+};
+
+/**
+ * What happened to one process; every process arrives at time 0
+ */
+struct Outcome {
+    uint32_t weight = 1;
+    uint64_t service = 0;             // instructions it executed
+    uint64_t first_run = UINT64_MAX;  // ticks it waited before its first instruction
+    uint64_t finished = 0;            // tick it was done at
+
+    /**
+     * Turnaround and response averages, and Jain's index over each process's CPU rate per unit of weight
+     * (service / turnaround / weight): 1 when every process progressed in proportion to its weight.
+     */
+    static void summarize(const std::vector<Outcome> &outcomes, Stats &stats) {
+        if (outcomes.empty()) {
+            return;
+        }
+        double turnaround = 0, response = 0, sum = 0, sum_of_squares = 0;
+        for (const auto &outcome: outcomes) {
+            turnaround += outcome.finished;
+            response += outcome.first_run == UINT64_MAX ? outcome.finished : outcome.first_run;
+            const double rate = outcome.finished
+                                    ? static_cast<double>(outcome.service) / outcome.finished / outcome.weight
+                                    : 0;
+            sum += rate;
+            sum_of_squares += rate * rate;
+        }
+        const double n = static_cast<double>(outcomes.size());
+        stats.mean_turnaround = turnaround / n;
+        stats.mean_response = response / n;
+        stats.fairness = sum_of_squares > 0 ? sum * sum / (n * sum_of_squares) : 1;
+    }
+};
+
+/**
+ * Scheduler.run() from process_run.py, tick for tick
+ */
+class Scheduler {
+public:
+    Scheduler(SwitchBehavior process_switch_behavior, IoDoneBehavior io_done_behavior, int io_length)
+        : process_switch_behavior(process_switch_behavior), io_done_behavior(io_done_behavior),
+          io_length(io_length) {
+    }
+
+    void add(const Program &program) {
+        processes.push_back({program, 0, STATE_READY, 0});
+        outcomes.push_back({program.weight});
+    }
+
+    int getNumberOfProcesses() const {
+        return static_cast<int>(processes.size());
+    }
+
+    const std::vector<Outcome> &getOutcomes() const {
+        return outcomes;
+    }
+
+    /**
+     * @param trace Where to print the per-tick table (the -c output), or null to only count.
+     */
+    Stats run(std::string *trace = nullptr) {
+        Stats stats;
+        if (processes.empty()) {
+            return stats;
+        }
+        curr_proc = 0;
+        moveToRunning(STATE_READY);
+        int active = getNumberOfProcesses();
+
+        char cell[32];
+        if (trace) {
+            *trace += "Time";
+            for (int pid = 0; pid < getNumberOfProcesses(); ++pid) {
+                snprintf(cell, sizeof(cell), "PID:%2d", pid);
+                column(*trace, cell);
+            }
+            column(*trace, "CPU");
+            column(*trace, "IOs");
+            *trace += "\n";
+        }
+
+        while (active > 0) {
+            clock_tick = ++stats.clock_tick;
+
+            // check for io finish
+            bool io_done = false;
+            for (int pid = 0; pid < getNumberOfProcesses(); ++pid) {
+                if (processes[pid].state != STATE_WAIT || processes[pid].io_finish_time != clock_tick) {
+                    continue;
+                }
+                io_done = true;
+                moveToReady(STATE_WAIT, pid);
+                if (io_done_behavior == IO_RUN_IMMEDIATE) {
+                    if (curr_proc != pid && processes[curr_proc].state == STATE_RUNNING) {
+                        moveToReady(STATE_RUNNING, curr_proc);
+                    }
+                    nextProc(pid);
+                } else {
+                    if (process_switch_behavior == SWITCH_ON_END && getNumberOfRunnable() > 1) {
+                        // this means the process that issued the io should be run
+                        nextProc(pid);
+                    }
+                    if (getNumberOfRunnable() == 1) {
+                        // this is the only thing to run: so run it
+                        nextProc(pid);
+                    }
+                }
+                active -= checkIfDone();
+            }
+
+            // if current proc is RUNNING and has an instruction, execute it
+            Process &current = processes[curr_proc];
+            const bool executing = current.state == STATE_RUNNING && !current.isFinished();
+            const Op instruction = executing ? current.pop() : DO_COMPUTE;
+            stats.cpu_busy += executing;
+            if (executing) {
+                Outcome &outcome = outcomes[curr_proc];
+                outcome.first_run = std::min(outcome.first_run, clock_tick - 1);
+                ++outcome.service;
+            }
+
+            int in_flight = 0;
+            for (const auto &process: processes) {
+                in_flight += process.io_finish_time > clock_tick;
+            }
+            stats.io_busy += in_flight > 0;
+
+            if (trace) {
+                snprintf(cell, sizeof(cell), io_done ? "%3lu*" : "%3lu ", static_cast<unsigned long>(clock_tick));
+                *trace += cell;
+                for (int pid = 0; pid < getNumberOfProcesses(); ++pid) {
+                    if (pid == curr_proc && executing) {
+                        snprintf(cell, sizeof(cell), "RUN:%s", OP_NAMES[instruction]);
+                        column(*trace, cell);
+                    } else {
+                        column(*trace, STATE_NAMES[processes[pid].state]);
+                    }
+                }
+                column(*trace, executing ? "1" : " ");
+                snprintf(cell, sizeof(cell), "%d", in_flight);
+                column(*trace, in_flight > 0 ? cell : " ");
+                *trace += "\n";
+            }
+
+            // if this is an IO instruction, switch to waiting state and add an io completion in the future
+            if (executing && instruction == DO_IO) {
+                moveToWait(STATE_RUNNING);
+                current.io_finish_time = clock_tick + io_length;
+                if (process_switch_behavior == SWITCH_ON_IO) {
+                    nextProc();
+                }
+            }
+
+            // ENDCASE: check if currently running thing is out of instructions
+            active -= checkIfDone();
+        }
+        Outcome::summarize(outcomes, stats);
+        return stats;
+    }
+
+private:
+    struct Process {
+        Program code;
+        size_t pc; // index of the run the next instruction comes from
+        State state;
+        uint64_t io_finish_time; // of the latest IO this process issued
+
+        bool isFinished() const {
+            return pc == code.runs.size();
+        }
+
+        Op pop() {
+            auto &run = code.runs[pc];
+            const Op op = run.op;
+            if (--run.count == 0) {
+                ++pc;
+            }
+            return op;
+        }
+    };
+
+    SwitchBehavior process_switch_behavior;
+    IoDoneBehavior io_done_behavior;
+    int io_length;
+    std::vector<Process> processes;
+    std::vector<Outcome> outcomes;
+    int curr_proc = 0;
+    uint64_t clock_tick = 0;
+
+    static void column(std::string &out, const char *text) {
+        char cell[48];
+        snprintf(cell, sizeof(cell), " %10s", text);
+        out += cell;
+    }
+
+    void moveToReady(State expected, int pid) {
+        if (processes[pid].state != expected) {
+            std::abort();
+        }
+        processes[pid].state = STATE_READY;
+    }
+
+    void moveToWait(State expected) {
+        if (processes[curr_proc].state != expected) {
+            std::abort();
+        }
+        processes[curr_proc].state = STATE_WAIT;
+    }
+
+    void moveToRunning(State expected) {
+        if (processes[curr_proc].state != expected) {
+            std::abort();
+        }
+        processes[curr_proc].state = STATE_RUNNING;
+    }
+
+    void nextProc(int pid = -1) {
+        if (pid != -1) {
+            curr_proc = pid;
+            moveToRunning(STATE_READY);
+            return;
+        }
+        // round robin from the one after the current process, wrapping around to it
+        const int n = getNumberOfProcesses();
+        for (int offset = 1; offset <= n; ++offset) {
+            const int candidate = (curr_proc + offset) % n;
+            if (processes[candidate].state == STATE_READY) {
+                curr_proc = candidate;
+                moveToRunning(STATE_READY);
+                return;
+            }
+        }
+    }
+
+    int getNumberOfRunnable() const {
+        int runnable = 0;
+        for (const auto &process: processes) {
+            runnable += process.state == STATE_READY || process.state == STATE_RUNNING;
+        }
+        return runnable;
+    }
+
+    // @return 1 if the current process just finished, 0 otherwise.
+    int checkIfDone() {
+        if (processes[curr_proc].isFinished() && processes[curr_proc].state == STATE_RUNNING) {
+            processes[curr_proc].state = STATE_DONE;
+            outcomes[curr_proc].finished = clock_tick;
+            nextProc();
+            return 1;
+        }
+        return 0;
+    }
+};
+
+/**
+ * A ready queue and the rule for picking from it. The simulator owns the running process; a policy only sees
+ * processes while they are ready, plus how long the running one ran for.
+ */
+class Policy {
+public:
+    virtual ~Policy() = default;
+
+    virtual const char *getName() const = 0;
+
+    /**
+     * @param woken True when pid is back from an IO, false when it is new or was just preempted.
+     */
+    virtual void enqueue(int pid, bool woken, uint64_t now) = 0;
+
+    // Removes and returns the process to run next, or -1 if none is ready
+    virtual int pick(uint64_t now) = 0;
+
+    // How many ticks pid may run before it is preempted
+    virtual uint64_t getSlice(int pid) = 0;
+
+    // pid, picked earlier, just ran for ticks
+    virtual void charge(int /*pid*/, uint64_t /*ticks*/) {
+    }
+
+    // Whether a ready process should take the CPU from running right away
+    virtual bool preempts(int /*running*/) const {
+        return false;
+    }
+};
+
+/**
+ * Round robin: one FIFO, a fixed quantum
+ */
+class RoundRobin : public Policy {
+public:
+    explicit RoundRobin(uint64_t quantum) : quantum(quantum) {
+    }
+
+    const char *getName() const override {
+        return "rr";
+    }
+
+    void enqueue(int pid, bool, uint64_t) override {
+        ready.push_back(pid);
+    }
+
+    int pick(uint64_t) override {
+        if (ready.empty()) {
+            return -1;
+        }
+        const int pid = ready.front();
+        ready.pop_front();
+        return pid;
+    }
+
+    uint64_t getSlice(int) override {
+        return quantum;
+    }
+
+private:
+    uint64_t quantum;
+    std::deque<int> ready;
+};
+
+/**
+ * Multi-level feedback queue (OSTEP's rules): new processes start at the top level; a process that uses up its
+ * allotment at a level, over any number of slices, drops one level; every boost ticks everyone returns to the top.
+ * Level l has quantum and allotment quantum << l. Picking scans the few levels, so it is O(1).
+ */
+class Mlfq : public Policy {
+public:
+    Mlfq(uint64_t quantum, int levels, uint64_t boost, int processes)
+        : quantum(quantum), boost(boost), queues(levels), level(processes, 0), used(processes, 0),
+          epoch(processes, 0) {
+    }
+
+    const char *getName() const override {
+        return "mlfq";
+    }
+
+    void enqueue(int pid, bool, uint64_t now) override {
+        boostIfDue(now);
+        if (epoch[pid] != current_epoch) {
+            // it was running or waiting on IO when the boost happened
+            epoch[pid] = current_epoch;
+            level[pid] = 0;
+            used[pid] = 0;
+        }
+        queues[level[pid]].push_back(pid);
+    }
+
+    int pick(uint64_t now) override {
+        boostIfDue(now);
+        for (auto &queue: queues) {
+            if (!queue.empty()) {
+                const int pid = queue.front();
+                queue.pop_front();
+                return pid;
+            }
+        }
+        return -1;
+    }
+
+    uint64_t getSlice(int pid) override {
+        return (quantum << level[pid]) - used[pid];
+    }
+
+    void charge(int pid, uint64_t ticks) override {
+        used[pid] += ticks;
+        if (used[pid] >= quantum << level[pid]) {
+            used[pid] = 0;
+            level[pid] = std::min(level[pid] + 1, static_cast<int>(queues.size()) - 1);
+        }
+    }
+
+    bool preempts(int running) const override {
+        for (int l = 0; l < level[running]; ++l) {
+            if (!queues[l].empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    uint64_t quantum;
+    uint64_t boost;
+    std::vector<std::deque<int>> queues;
+    std::vector<int> level;
+    std::vector<uint64_t> used;     // of the allotment at its current level
+    std::vector<uint32_t> epoch;    // boosts it has seen
+    uint32_t current_epoch = 0;
+    uint64_t next_boost = 0;
+
+    // Boosts are checked at scheduling points, so one lands at most a quantum late
+    void boostIfDue(uint64_t now) {
+        if (boost == 0 || now < next_boost) {
+            return;
+        }
+        next_boost = now - now % boost + boost;
+        if (now == 0) {
+            return;
+        }
+        ++current_epoch;
+        for (size_t l = 1; l < queues.size(); ++l) {
+            for (const int pid: queues[l]) {
+                queues[0].push_back(pid);
+            }
+            queues[l].clear();
+        }
+        for (const int pid: queues[0]) {
+            epoch[pid] = current_epoch;
+            level[pid] = 0;
+            used[pid] = 0;
+        }
+    }
+};
+
+/**
+ * Lottery: tickets of the ready processes in a Fenwick tree, so a draw and an update are both O(log n)
+ */
+class Lottery : public Policy {
+public:
+    Lottery(uint64_t quantum, const std::vector<uint32_t> &weights, uint64_t seed)
+        : quantum(quantum), weights(weights), tree(weights.size() + 1, 0), random(seed) {
+        while (top_bit * 2 <= weights.size()) {
+            top_bit *= 2;
+        }
+    }
+
+    const char *getName() const override {
+        return "lottery";
+    }
+
+    void enqueue(int pid, bool, uint64_t) override {
+        add(pid, weights[pid]);
+    }
+
+    int pick(uint64_t) override {
+        if (total == 0) {
+            return -1;
+        }
+        // the winner is the first process whose prefix sum of tickets passes the draw
+        uint64_t draw = random() % total;
+        size_t position = 0;
+        for (size_t step = top_bit; step > 0; step /= 2) {
+            if (position + step < tree.size() && tree[position + step] <= draw) {
+                position += step;
+                draw -= tree[position];
+            }
+        }
+        const int pid = static_cast<int>(position);
+        add(pid, -static_cast<int64_t>(weights[pid]));
+        return pid;
+    }
+
+    uint64_t getSlice(int) override {
+        return quantum;
+    }
+
+private:
+    uint64_t quantum;
+    std::vector<uint32_t> weights;
+    std::vector<uint64_t> tree; // 1-based Fenwick tree of the tickets held by ready processes
+    uint64_t total = 0;
+    size_t top_bit = 1;
+    std::mt19937_64 random;
+
+    void add(int pid, int64_t tickets) {
+        total += tickets;
+        for (size_t i = pid + 1; i < tree.size(); i += i & -i) {
+            tree[i] += tickets;
+        }
+    }
+};
+
+/**
+ * Stride: each process advances its pass by STRIDE / weight per quantum of CPU, and the lowest pass runs next.
+ * A process coming back from IO starts no lower than the current pass, so sleeping earns no credit.
+ */
+class Stride : public Policy {
+public:
+    Stride(uint64_t quantum, const std::vector<uint32_t> &weights)
+        : quantum(quantum), weights(weights), pass(weights.size(), 0) {
+    }
+
+    const char *getName() const override {
+        return "stride";
+    }
+
+    void enqueue(int pid, bool woken, uint64_t) override {
+        if (woken) {
+            pass[pid] = std::max(pass[pid], global_pass);
+        }
+        ready.push({pass[pid], pid});
+    }
+
+    int pick(uint64_t) override {
+        if (ready.empty()) {
+            return -1;
+        }
+        const int pid = ready.top().second;
+        ready.pop();
+        global_pass = pass[pid];
+        return pid;
+    }
+
+    uint64_t getSlice(int) override {
+        return quantum;
+    }
+
+    void charge(int pid, uint64_t ticks) override {
+        pass[pid] += STRIDE * ticks / (quantum * weights[pid]);
+    }
+
+private:
+    static constexpr uint64_t STRIDE = 1 << 20;
+    uint64_t quantum;
+    std::vector<uint32_t> weights;
+    std::vector<uint64_t> pass;
+    uint64_t global_pass = 0;
+    std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>, std::greater<>> ready;
+};
+
+/**
+ * CFS-like: ready processes ordered by virtual runtime in a red-black tree (std::set), leftmost runs next.
+ * Virtual runtime advances by ticks * NICE_0 / weight. Slices split a latency period by weight, with a floor.
+ * A waking process is placed half a period behind the minimum, and preempts the running one when it is more than
+ * a wakeup granularity ahead of it.
+ */
+class Cfs : public Policy {
+public:
+    Cfs(uint64_t quantum, const std::vector<uint32_t> &weights)
+        : latency(4 * quantum * NICE_0), min_granularity(std::max<uint64_t>(1, quantum / 4)),
+          wakeup_granularity(std::max<uint64_t>(1, quantum / 4) * NICE_0), weights(weights),
+          vruntime(weights.size(), 0) {
+    }
+
+    const char *getName() const override {
+        return "cfs";
+    }
+
+    void enqueue(int pid, bool woken, uint64_t) override {
+        if (woken) {
+            vruntime[pid] = std::max(vruntime[pid], min_vruntime > latency / 2 ? min_vruntime - latency / 2 : 0);
+        }
+        ready.insert({vruntime[pid], pid});
+        ready_weight += weights[pid];
+    }
+
+    int pick(uint64_t) override {
+        if (ready.empty()) {
+            return -1;
+        }
+        const int pid = ready.begin()->second;
+        ready.erase(ready.begin());
+        ready_weight -= weights[pid];
+        min_vruntime = std::max(min_vruntime, vruntime[pid]);
+        return pid;
+    }
+
+    uint64_t getSlice(int pid) override {
+        const uint64_t total = ready_weight + weights[pid];
+        return std::max(min_granularity, latency / NICE_0 * weights[pid] / total);
+    }
+
+    void charge(int pid, uint64_t ticks) override {
+        vruntime[pid] += ticks * NICE_0 / weights[pid];
+    }
+
+    bool preempts(int running) const override {
+        return !ready.empty() && ready.begin()->first + wakeup_granularity < vruntime[running];
+    }
+
+private:
+    static constexpr uint64_t NICE_0 = 1024;
+    uint64_t latency;             // in virtual time
+    uint64_t min_granularity;     // in ticks
+    uint64_t wakeup_granularity;  // in virtual time
+    std::vector<uint32_t> weights;
+    std::vector<uint64_t> vruntime;
+    std::set<std::pair<uint64_t, int>> ready;
+    uint64_t ready_weight = 0;
+    uint64_t min_vruntime = 0;
+};
+
+/**
+ * Runs programs under a Policy. Instead of stepping every process every tick, it runs the current process until
+ * the next event (end of its run, its slice, or the next IO completion) and jumps over idle stretches, so the
+ * cost is O(events * log n) rather than O(ticks * n). IO timing follows process_run.py: an IO takes one tick of
+ * CPU to issue, the process is ready again io_length ticks later, and the ticks in between count as IO busy.
+ */
+class PolicySimulator {
+public:
+    PolicySimulator(const std::vector<Program> &programs, int io_length) : io_length(io_length) {
+        for (const auto &program: programs) {
+            processes.push_back({program, 0});
+            outcomes.push_back({program.weight});
+        }
+    }
+
+    std::vector<uint32_t> getWeights() const {
+        std::vector<uint32_t> weights;
+        for (const auto &outcome: outcomes) {
+            weights.push_back(outcome.weight);
+        }
+        return weights;
+    }
+
+    const std::vector<Outcome> &getOutcomes() const {
+        return outcomes;
+    }
+
+    Stats run(Policy &policy) {
+        Stats stats;
+        int active = 0;
+        for (int pid = 0; pid < static_cast<int>(processes.size()); ++pid) {
+            if (processes[pid].pc < processes[pid].code.runs.size()) {
+                policy.enqueue(pid, false, 0);
+                ++active;
+            } else {
+                outcomes[pid].first_run = 0;
+            }
+        }
+
+        // (tick the process is ready again, pid), soonest first
+        std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>, std::greater<>> io;
+        uint64_t now = 0, io_busy_until = 0, slice = 0;
+        int running = -1;
+        while (active > 0) {
+            while (!io.empty() && io.top().first == now + 1) {
+                policy.enqueue(io.top().second, true, now);
+                io.pop();
+            }
+            if (running >= 0 && policy.preempts(running)) {
+                policy.enqueue(running, false, now);
+                running = -1;
+            }
+            if (running < 0) {
+                running = policy.pick(now);
+                if (running < 0) {
+                    now = io.top().first - 1; // idle until the next IO completes
+                    continue;
+                }
+                slice = std::max<uint64_t>(1, policy.getSlice(running));
+                outcomes[running].first_run = std::min(outcomes[running].first_run, now);
+            }
+
+            Process &process = processes[running];
+            auto &run = process.code.runs[process.pc];
+            uint64_t ticks = 1;
+            if (run.op == DO_COMPUTE) {
+                ticks = std::min<uint64_t>(run.count, slice);
+                if (!io.empty()) {
+                    ticks = std::min(ticks, io.top().first - now - 1);
+                }
+            }
+            now += ticks;
+            stats.cpu_busy += ticks;
+            outcomes[running].service += ticks;
+            policy.charge(running, ticks);
+            slice -= ticks;
+            const Op op = run.op;
+            run.count -= static_cast<uint32_t>(ticks);
+            if (run.count == 0) {
+                ++process.pc;
+            }
+
+            if (op == DO_IO) {
+                // the IO is in flight from the next tick until the one before it completes
+                const uint64_t done = now + io_length;
+                stats.io_busy += done - 1 - std::max(now, std::min(io_busy_until, done - 1));
+                io_busy_until = std::max(io_busy_until, done - 1);
+                if (process.pc == process.code.runs.size()) {
+                    // like process_run.py, a process is done once its last IO completes
+                    outcomes[running].finished = done;
+                    --active;
+                    stats.clock_tick = std::max(stats.clock_tick, done);
+                } else {
+                    io.push({done, running});
+                }
+                running = -1;
+            } else if (process.pc == process.code.runs.size()) {
+                outcomes[running].finished = now;
+                --active;
+                running = -1;
+            } else if (slice == 0) {
+                policy.enqueue(running, false, now);
+                running = -1;
+            }
+        }
+        stats.clock_tick = std::max(stats.clock_tick, now);
+        Outcome::summarize(outcomes, stats);
+        return stats;
+    }
+
+private:
+    struct Process {
+        Program code;
+        size_t pc;
+    };
+
+    int io_length;
+    std::vector<Process> processes;
+    std::vector<Outcome> outcomes;
+};
+
+struct Options {
+    uint64_t seed = 0;
+    std::string process_list;
+    std::string program_files;
+    int io_length = 5;
+    SwitchBehavior process_switch_behavior = SWITCH_ON_IO;
+    IoDoneBehavior io_done_behavior = IO_RUN_LATER;
+    bool solve = false;
+    bool print_stats = false;
+    // --policy: "python" is the tick-for-tick engine with -S and -I; the rest run on PolicySimulator
+    std::vector<std::string> policies;
+    uint64_t quantum = 10;
+    int levels = 3;
+    uint64_t boost = 100;
+    // --sweep
+    bool sweep = false;
+    int seeds = 100;
+    std::vector<int> io_lengths = {1, 2, 5, 10};
+    std::vector<int> cpu_percents;
+    int jobs = 0;
+};
+
+std::vector<std::string> split(const std::string &text) {
+    std::vector<std::string> items;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+std::vector<int> parseInts(const std::string &text) {
+    std::vector<int> values;
+    for (const auto &item: split(text)) {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+/**
+ * -l entries, with K*X:Y[:W] standing for K copies of X:Y[:W]
+ */
+std::vector<std::string> expandDescriptions(const std::string &process_list) {
+    std::vector<std::string> descriptions;
+    for (const auto &item: split(process_list)) {
+        const auto star = item.find('*');
+        const long copies = star == std::string::npos ? 1 : std::strtol(item.substr(0, star).c_str(), nullptr, 10);
+        for (long i = 0; i < copies; ++i) {
+            descriptions.push_back(star == std::string::npos ? item : item.substr(star + 1));
+        }
+    }
+    return descriptions;
+}
+
+/**
+ * @return null for "python" and for names that are not policies.
+ */
+std::unique_ptr<Policy> makePolicy(const std::string &name, const Options &options,
+                                   const std::vector<uint32_t> &weights, uint64_t seed) {
+    if (name == "rr") {
+        return std::make_unique<RoundRobin>(options.quantum);
+    } else if (name == "mlfq") {
+        return std::make_unique<Mlfq>(options.quantum, options.levels, options.boost,
+                                      static_cast<int>(weights.size()));
+    } else if (name == "lottery") {
+        return std::make_unique<Lottery>(options.quantum, weights, seed);
+    } else if (name == "stride") {
+        return std::make_unique<Stride>(options.quantum, weights);
+    } else if (name == "cfs") {
+        return std::make_unique<Cfs>(options.quantum, weights);
+    }
+    return nullptr;
+}
+
+const char *POLICY_NAMES[] = {"python", "rr", "mlfq", "lottery", "stride", "cfs"};
+
+void usage(const char *program) {
+    std::cerr << "usage: " << program << " [-s SEED] [-l X1:Y1,X2:Y2,...] [-F FILE1,FILE2,...] [-L IOLENGTH]\n"
+              << "       [-S SWITCH_ON_IO|SWITCH_ON_END] [-I IO_RUN_LATER|IO_RUN_IMMEDIATE] [-c] [-p]\n"
+              << "       [--policy=python|rr|mlfq|lottery|stride|cfs,...] [-q QUANTUM] [--levels=N] [--boost=TICKS]\n"
+              << "       " << program << " --sweep -l X1:Y1,... [--seeds=N] [--iolengths=L1,L2,...]"
+              << " [--cpu=P1,P2,...] [-j JOBS]\n"
+              << "  -l entries may be K*X:Y for K copies, and X:Y:W to give a process weight W\n";
+    exit(1);
+}
+
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i], value;
+        // -s 3, --seed 3 and --seed=3 all work, as with optparse
+        const auto equals = arg.find('=');
+        const bool takes_value = arg != "-c" && arg != "-p" && arg != "--printstats" && arg != "--sweep";
+        if (arg.starts_with("--") && equals != std::string::npos) {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        } else if (takes_value) {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            value = argv[++i];
+        }
+
+        if (arg == "-s" || arg == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "-l" || arg == "--processlist") {
+            options.process_list = value;
+        } else if (arg == "-F" || arg == "--programs") {
+            options.program_files = value;
+        } else if (arg == "-L" || arg == "--iolength") {
+            options.io_length = std::atoi(value.c_str());
+        } else if (arg == "-S" || arg == "--switch") {
+            if (value != "SWITCH_ON_IO" && value != "SWITCH_ON_END") {
+                usage(argv[0]);
+            }
+            options.process_switch_behavior = value == "SWITCH_ON_IO" ? SWITCH_ON_IO : SWITCH_ON_END;
+        } else if (arg == "-I" || arg == "--iodone") {
+            if (value != "IO_RUN_LATER" && value != "IO_RUN_IMMEDIATE") {
+                usage(argv[0]);
+            }
+            options.io_done_behavior = value == "IO_RUN_LATER" ? IO_RUN_LATER : IO_RUN_IMMEDIATE;
+        } else if (arg == "-c") {
+            options.solve = true;
+        } else if (arg == "-p" || arg == "--printstats") {
+            options.print_stats = true;
+        } else if (arg == "--policy") {
+            options.policies = split(value);
+            for (const auto &policy: options.policies) {
+                if (std::find(std::begin(POLICY_NAMES), std::end(POLICY_NAMES), policy) == std::end(POLICY_NAMES)) {
+                    usage(argv[0]);
+                }
+            }
+        } else if (arg == "-q" || arg == "--quantum") {
+            options.quantum = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--levels") {
+            options.levels = std::atoi(value.c_str());
+        } else if (arg == "--boost") {
+            options.boost = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--sweep") {
+            options.sweep = true;
+        } else if (arg == "--seeds") {
+            options.seeds = std::atoi(value.c_str());
+        } else if (arg == "--iolengths") {
+            options.io_lengths = parseInts(value);
+        } else if (arg == "--cpu") {
+            options.cpu_percents = parseInts(value);
+        } else if (arg == "-j" || arg == "--jobs") {
+            options.jobs = std::atoi(value.c_str());
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.sweep && (options.process_list.empty() || options.seeds < 1 || options.io_lengths.empty())) {
+        usage(argv[0]);
+    }
+    if (options.io_length < 1 || options.quantum < 1 || options.levels < 1) {
+        usage(argv[0]);
+    }
+    return options;
+}
+
+/**
+ * Runs programs under one policy name: the Python engine for "python", PolicySimulator otherwise
+ * @param outcomes Filled with the per-process results if not null.
+ * @param trace Gets the Python engine's per-tick table if not null.
+ */
+Stats simulate(const std::string &policy_name, const Options &options, SwitchBehavior process_switch_behavior,
+               IoDoneBehavior io_done_behavior, int io_length, const std::vector<Program> &programs, uint64_t seed,
+               std::vector<Outcome> *outcomes = nullptr, std::string *trace = nullptr) {
+    if (policy_name == "python") {
+        Scheduler scheduler(process_switch_behavior, io_done_behavior, io_length);
+        for (const auto &program: programs) {
+            scheduler.add(program);
+        }
+        const Stats stats = scheduler.run(trace);
+        if (outcomes) {
+            *outcomes = scheduler.getOutcomes();
+        }
+        return stats;
+    }
+    PolicySimulator simulator(programs, io_length);
+    const auto policy = makePolicy(policy_name, options, simulator.getWeights(), seed);
+    const Stats stats = simulator.run(*policy);
+    if (outcomes) {
+        *outcomes = simulator.getOutcomes();
+    }
+    return stats;
+}
+
+/**
+ * Every combination of policy, IO length and CPU percentage, each averaged over --seeds random programs.
+ * Without --policy the policies are the four SWITCH_ON_* x IO_RUN_* combinations of the Python engine.
+ * Configurations are handed to -j threads through one atomic counter, and each writes only its own slot.
+ */
+void sweep(const Options &options) {
+    struct Group {
+        std::string label;
+        std::string policy;
+        SwitchBehavior process_switch_behavior;
+        IoDoneBehavior io_done_behavior;
+        int io_length;
+        int cpu_percent; // -1: as given in -l
+    };
+    struct Behavior {
+        std::string label;
+        std::string policy;
+        SwitchBehavior process_switch_behavior;
+        IoDoneBehavior io_done_behavior;
+    };
+    std::vector<Behavior> behaviors;
+    if (options.policies.empty()) {
+        for (const auto process_switch_behavior: {SWITCH_ON_IO, SWITCH_ON_END}) {
+            for (const auto io_done_behavior: {IO_RUN_LATER, IO_RUN_IMMEDIATE}) {
+                behaviors.push_back({std::string(process_switch_behavior == SWITCH_ON_IO ? "SWITCH_ON_IO"
+                                                                                         : "SWITCH_ON_END")
+                                         + "+" + (io_done_behavior == IO_RUN_LATER ? "IO_RUN_LATER"
+                                                                                   : "IO_RUN_IMMEDIATE"),
+                                     "python", process_switch_behavior, io_done_behavior});
+            }
+        }
+    } else {
+        for (const auto &policy: options.policies) {
+            behaviors.push_back({policy, policy, options.process_switch_behavior, options.io_done_behavior});
+        }
+    }
+    std::vector<Group> groups;
+    const std::vector<int> cpu_percents = options.cpu_percents.empty() ? std::vector<int>{-1} : options.cpu_percents;
+    for (const auto &behavior: behaviors) {
+        for (const int io_length: options.io_lengths) {
+            for (const int cpu_percent: cpu_percents) {
+                groups.push_back({behavior.label, behavior.policy, behavior.process_switch_behavior,
+                                  behavior.io_done_behavior, io_length, cpu_percent});
+            }
+        }
+    }
+
+    const std::vector<std::string> descriptions = expandDescriptions(options.process_list);
+    const uint64_t configurations = groups.size() * static_cast<uint64_t>(options.seeds);
+    std::vector<Stats> results(configurations);
+    std::atomic<uint64_t> next{0};
+    std::atomic<bool> malformed{false};
+    auto work = [&] {
+        for (uint64_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < configurations;) {
+            const Group &group = groups[c / options.seeds];
+            const uint64_t seed = options.seed + c % options.seeds;
+            PythonRandom random(seed);
+            std::vector<Program> programs(descriptions.size());
+            for (size_t d = 0; d < descriptions.size(); ++d) {
+                if (!Program::describe(descriptions[d], random, programs[d], group.cpu_percent)) {
+                    malformed = true;
+                    return;
+                }
+            }
+            results[c] = simulate(group.policy, options, group.process_switch_behavior, group.io_done_behavior,
+                                  std::max(1, group.io_length), programs, seed);
+        }
+    };
+    const int jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (int j = 1; j < jobs; ++j) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    if (malformed) {
+        std::cerr << "Bad description in " << options.process_list << ": each must be X:Y\n";
+        exit(1);
+    }
+
+    std::string out = "policy,iolength,cpu_percent,runs,mean_time,cpu_utilization,io_utilization,"
+                      "mean_turnaround,mean_response,fairness\n";
+    char line[512];
+    for (size_t g = 0; g < groups.size(); ++g) {
+        uint64_t time = 0, cpu = 0, io = 0;
+        double turnaround = 0, response = 0, fairness = 0;
+        for (int s = 0; s < options.seeds; ++s) {
+            const Stats &stats = results[g * options.seeds + s];
+            time += stats.clock_tick;
+            cpu += stats.cpu_busy;
+            io += stats.io_busy;
+            turnaround += stats.mean_turnaround;
+            response += stats.mean_response;
+            fairness += stats.fairness;
+        }
+        const Group &group = groups[g];
+        snprintf(line, sizeof(line), "%s,%d,%d,%d,%.2f,%.4f,%.4f,%.2f,%.2f,%.4f\n", group.label.c_str(),
+                 group.io_length, group.cpu_percent, options.seeds, static_cast<double>(time) / options.seeds,
+                 time ? static_cast<double>(cpu) / time : 0, time ? static_cast<double>(io) / time : 0,
+                 turnaround / options.seeds, response / options.seeds, fairness / options.seeds);
+        out += line;
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+}
+
+void printStats(const Stats &stats) {
+    printf("\n");
+    printf("Stats: Total Time %lu\n", static_cast<unsigned long>(stats.clock_tick));
+    printf("Stats: CPU Busy %lu (%.2f%%)\n", static_cast<unsigned long>(stats.cpu_busy),
+           100.0 * stats.cpu_busy / stats.clock_tick);
+    printf("Stats: IO Busy  %lu (%.2f%%)\n", static_cast<unsigned long>(stats.io_busy),
+           100.0 * stats.io_busy / stats.clock_tick);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    const Options options = parseOptions(argc, argv);
+    if (options.sweep) {
+        sweep(options);
+        return 0;
+    }
+
+    PythonRandom random(options.seed);
+    std::vector<Program> programs;
+    for (const auto &description: expandDescriptions(options.process_list)) {
+        Program program;
+        if (!Program::describe(description, random, program)) {
+            printf("Bad description (%s): Must be number <x:y>\n", description.c_str());
+            printf("  where X is the number of instructions\n");
+            printf("  and Y is the percent change that an instruction is CPU not IO\n");
+            return 1;
+        }
+        programs.push_back(program);
+    }
+    for (const auto &path: split(options.program_files)) {
+        Program program;
+        if (!Program::load(path, program)) {
+            fprintf(stderr, "Cannot load program %s\n", path.c_str());
+            return 1;
+        }
+        programs.push_back(program);
+    }
+    const std::vector<std::string> policies = options.policies.empty() ? std::vector<std::string>{"python"}
+                                                                       : options.policies;
+
+    if (!options.solve) {
+        printf("Produce a trace of what would happen when you run these processes:\n");
+        for (size_t pid = 0; pid < programs.size(); ++pid) {
+            printf("Process %zu\n", pid);
+            for (const auto &run: programs[pid].runs) {
+                for (uint32_t i = 0; i < run.count; ++i) {
+                    printf("  %s\n", OP_NAMES[run.op]);
+                }
+            }
+            printf("\n");
+        }
+        printf("Important behaviors:\n");
+        if (policies.size() == 1 && policies[0] == "python") {
+            printf("  System will switch when %s\n", options.process_switch_behavior == SWITCH_ON_IO
+                                                         ? "the current process is FINISHED or ISSUES AN IO"
+                                                         : "the current process is FINISHED");
+            printf("  After IOs, the process issuing the IO will %s\n",
+                   options.io_done_behavior == IO_RUN_IMMEDIATE ? "run IMMEDIATELY"
+                                                                : "run LATER (when it is its turn)");
+        } else {
+            for (const auto &policy: policies) {
+                printf("  Scheduled by %s, quantum %lu\n", policy.c_str(), static_cast<unsigned long>(options.quantum));
+            }
+        }
+        printf("\n");
+        return 0;
+    }
+
+    for (const auto &policy: policies) {
+        std::vector<Outcome> outcomes;
+        std::string trace;
+        const bool python = policy == "python";
+        const Stats stats = simulate(policy, options, options.process_switch_behavior, options.io_done_behavior,
+                                     options.io_length, programs, options.seed, &outcomes, python ? &trace : nullptr);
+        if (policies.size() > 1) {
+            printf("Policy %s\n", policy.c_str());
+        }
+        if (python) {
+            fwrite(trace.data(), 1, trace.size(), stdout);
+        } else {
+            printf("%6s %8s %10s %10s %10s\n", "PID", "weight", "service", "response", "turnaround");
+            for (size_t pid = 0; pid < outcomes.size(); ++pid) {
+                printf("%6zu %8u %10lu %10lu %10lu\n", pid, outcomes[pid].weight,
+                       static_cast<unsigned long>(outcomes[pid].service),
+                       static_cast<unsigned long>(outcomes[pid].first_run),
+                       static_cast<unsigned long>(outcomes[pid].finished));
+            }
+        }
+        if (options.print_stats && stats.clock_tick > 0) {
+            printStats(stats);
+            if (!python) {
+                printf("Stats: Mean Turnaround %.2f\n", stats.mean_turnaround);
+                printf("Stats: Mean Response %.2f\n", stats.mean_response);
+                printf("Stats: Fairness %.4f\n", stats.fairness);
+                printf("\n");
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE // clone()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "common.h"
+
+/*
+ * Process-creation benchmark: p1.c through p4.c in a loop. Each cycle starts a child that execs -e
+ * (default /bin/true), then waits for it, using one of:
+ *   fork         copies the parent's page tables, which is what grows with its resident set
+ *   vfork        borrows the parent's address space until the child execs
+ *   posix_spawn  the library's choice, usually vfork-like
+ *   clone        clone(CLONE_VM | CLONE_VFORK) onto a stack of our own
+ * The sweep repeats every method with the parent holding each -r MiB of touched memory, and prints
+ * spawns/sec and cycle latency percentiles.
+ */
+
+#define CHILD_STACK (64 * 1024)
+
+typedef enum { FORK, VFORK, POSIX_SPAWN, CLONE, METHODS } spawn_method;
+
+static const char *method_names[METHODS] = {"fork", "vfork", "posix_spawn", "clone"};
+
+extern char **environ;
+
+char *child_argv[2];
+char *child_stack;
+
+int clone_child(void *arg) {
+    (void) arg;
+    execv(child_argv[0], child_argv);
+    _exit(127);
+}
+
+pid_t spawn(spawn_method method) {
+    pid_t pid = -1;
+    switch (method) {
+    case FORK:
+        pid = fork();
+        if (pid == 0) {
+            execv(child_argv[0], child_argv);
+            _exit(127);
+        }
+        break;
+    case VFORK:
+        pid = vfork();
+        if (pid == 0) {
+            execv(child_argv[0], child_argv);
+            _exit(127);
+        }
+        break;
+    case POSIX_SPAWN:
+        if (posix_spawn(&pid, child_argv[0], NULL, NULL, child_argv, environ) != 0)
+            pid = -1;
+        break;
+    case CLONE:
+        pid = clone(clone_child, child_stack + CHILD_STACK, CLONE_VM | CLONE_VFORK | SIGCHLD, NULL);
+        break;
+    default:
+        break;
+    }
+    return pid;
+}
+
+int compare(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *) x, b = *(const uint64_t *) y;
+    return (a > b) - (a < b);
+}
+
+void run(spawn_method method, int rss_mib, int iterations, uint64_t *latencies) {
+    // Give the parent a resident set of the requested size for fork to copy the page tables of
+    size_t bytes = (size_t) rss_mib << 20;
+    char *resident = NULL;
+    if (bytes > 0) {
+        resident = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(resident != MAP_FAILED);
+        memset(resident, 1, bytes);
+    }
+
+    uint64_t start = GetTimeNs();
+    for (int i = 0; i < iterations; i++) {
+        uint64_t begin = GetTimeNs();
+        pid_t pid = spawn(method);
+        if (pid < 0) {
+            fprintf(stderr, "%s failed\n", method_names[method]);
+            exit(1);
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s did not run\n", child_argv[0]);
+            exit(1);
+        }
+        latencies[i] = GetTimeNs() - begin;
+    }
+    double elapsed = (double) (GetTimeNs() - start) / 1e9;
+
+    qsort(latencies, iterations, sizeof(uint64_t), compare);
+    printf("%-12s %8d %12.0f %10.1f %10.1f %10.1f\n", method_names[method], rss_mib, iterations / elapsed,
+           latencies[iterations / 2] / 1e3, latencies[(int) (0.99 * (iterations - 1))] / 1e3,
+           latencies[iterations - 1] / 1e3);
+    if (resident)
+        munmap(resident, bytes);
+}
+
+void usage() {
+    fprintf(stderr, "usage: spawn_bench [-n iterations] [-r rss_mib,...] [-m method,...] [-e program]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 2000;
+    char sizes_arg[256] = "0,64,512";
+    char methods_arg[256] = "fork,vfork,posix_spawn,clone";
+    char *program = "/bin/true";
+    int c;
+    while ((c = getopt(argc, argv, "n:r:m:e:")) != -1) {
+        switch (c) {
+        case 'n': iterations = atoi(optarg); break;
+        case 'r': snprintf(sizes_arg, sizeof(sizes_arg), "%s", optarg); break;
+        case 'm': snprintf(methods_arg, sizeof(methods_arg), "%s", optarg); break;
+        case 'e': program = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc || iterations < 1)
+        usage();
+
+    int sizes[64], number_of_sizes = 0;
+    for (char *token = strtok(sizes_arg, ","); token && number_of_sizes < 64; token = strtok(NULL, ","))
+        sizes[number_of_sizes++] = atoi(token);
+    int methods[METHODS], number_of_methods = 0;
+    for (char *token = strtok(methods_arg, ","); token; token = strtok(NULL, ",")) {
+        int found = -1;
+        for (int m = 0; m < METHODS; m++)
+            if (strcmp(token, method_names[m]) == 0)
+                found = m;
+        if (found < 0 || number_of_methods == METHODS)
+            usage();
+        methods[number_of_methods++] = found;
+    }
+
+    child_argv[0] = program;
+    child_argv[1] = NULL;
+    child_stack = malloc(CHILD_STACK);
+    uint64_t *latencies = malloc(sizeof(uint64_t) * iterations);
+    assert(child_stack != NULL && latencies != NULL);
+
+    printf("%-12s %8s %12s %10s %10s %10s\n", "method", "rss_mib", "spawns/sec", "p50_us", "p99_us", "max_us");
+    for (int s = 0; s < number_of_sizes; s++)
+        for (int m = 0; m < number_of_methods; m++)
+            run(methods[m], sizes[s], iterations, latencies);
+
+    free(latencies);
+    free(child_stack);
+    return 0;
+}
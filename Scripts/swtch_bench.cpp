@@ -0,0 +1,170 @@
+// Context-switch cost: swtch() from xv6_kernel.c against the alternatives.
+//   gcc -O2 -c xv6_kernel.c && g++ -std=c++20 -O2 -pthread swtch_bench.cpp xv6_kernel.o -o swtch_bench
+// Every row is two sides handing control back and forth; the cost is per round trip, over to the other side and back.
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <ucontext.h>
+#include "common.h"
+#include "xv6_kernel.h"
+
+static long iterations;
+
+// --- swtch() between two bare stacks ---------------------------------------------------------------------------
+
+/*
+both sides run the same loop, so every swtch() is called from the same instruction and its `ret` goes back
+there. the return stack buffer predicts the return address from the call, so it only predicts right when
+the side switched to stopped at the same call site. if each side had its own call site, every `ret` would
+mispredict, and the row would measure that instead of the switch. fiber_yield() is symmetric the same way.
+ */
+static context *main_context, *side_context[2];
+
+static __attribute__((noinline)) void side(int me) {
+    for (long i = 0; i < iterations; i++)
+        swtch(&side_context[me], side_context[!me]);
+    swtch(&side_context[me], main_context); // the other side is left mid-loop and never resumed
+}
+
+static void side0(void) { side(0); }
+static void side1(void) { side(1); }
+
+static double bench_swtch() {
+    void *stacks[2] = {stack_alloc(), stack_alloc()};
+    side_context[0] = context_make(stacks[0], side0);
+    side_context[1] = context_make(stacks[1], side1);
+    uint64_t start = GetTimeNs();
+    swtch(&main_context, side_context[0]);
+    double ns = (double) (GetTimeNs() - start);
+    stack_free(stacks[1]);
+    stack_free(stacks[0]);
+    return ns / iterations; // side 0 makes `iterations` switches out, and each one comes back
+}
+
+// --- fiber_yield() between two fibers ----------------------------------------------------------------------------
+
+static void yielder(void *) {
+    for (long i = 0; i < iterations; i++)
+        fiber_yield();
+}
+
+static double bench_fibers() {
+    fiber_create(yielder, nullptr);
+    fiber_create(yielder, nullptr);
+    uint64_t start = GetTimeNs();
+    fiber_run();
+    return (double) (GetTimeNs() - start) / iterations;
+}
+
+// --- swapcontext(), which also saves and restores the signal mask with a system call each time ---------------------
+
+static ucontext_t main_ucontext, peer_ucontext;
+
+static void upeer() {
+    while (true)
+        swapcontext(&peer_ucontext, &main_ucontext);
+}
+
+static double bench_ucontext() {
+    void *stack = stack_alloc();
+    getcontext(&peer_ucontext);
+    peer_ucontext.uc_stack.ss_sp = stack;
+    peer_ucontext.uc_stack.ss_size = FIBER_STACK_SIZE;
+    peer_ucontext.uc_link = nullptr;
+    makecontext(&peer_ucontext, upeer, 0);
+    uint64_t start = GetTimeNs();
+    for (long i = 0; i < iterations; i++)
+        swapcontext(&main_ucontext, &peer_ucontext);
+    double ns = (double) (GetTimeNs() - start);
+    stack_free(stack);
+    return ns / iterations;
+}
+
+// --- two threads taking turns under a mutex and condition variable -------------------------------------------------
+
+static double bench_condvar(long rounds) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    long turn = 0; // even: main's turn, odd: the peer's
+    std::thread other([&] {
+        std::unique_lock lock(mutex);
+        for (long i = 0; i < rounds; i++) {
+            changed.wait(lock, [&] { return turn % 2 == 1; });
+            turn++;
+            changed.notify_one();
+        }
+    });
+    uint64_t start = GetTimeNs();
+    {
+        std::unique_lock lock(mutex);
+        for (long i = 0; i < rounds; i++) {
+            turn++;
+            changed.notify_one();
+            changed.wait(lock, [&] { return turn % 2 == 0; });
+        }
+    }
+    double ns = (double) (GetTimeNs() - start);
+    other.join();
+    return ns / rounds;
+}
+
+// --- a C++20 coroutine resumed and suspended in a loop --------------------------------------------------------------
+
+struct Loop {
+    struct promise_type {
+        Loop get_return_object() { return Loop{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::abort(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+static Loop suspender() {
+    while (true)
+        co_await std::suspend_always{};
+}
+
+// Out of line and through an opaque handle, so the compiler cannot inline the coroutine into the loop
+static __attribute__((noinline)) void resume(std::coroutine_handle<> handle) {
+    __asm__ __volatile__("" : "+r"(handle) : : "memory");
+    handle.resume();
+}
+
+// One resume plus the suspend that returns from it is one round trip
+static double bench_coroutine() {
+    Loop loop = suspender();
+    uint64_t start = GetTimeNs();
+    for (long i = 0; i < iterations; i++)
+        resume(loop.handle);
+    double ns = (double) (GetTimeNs() - start);
+    loop.handle.destroy();
+    return ns / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: swtch_bench [iterations]\n");
+        exit(1);
+    }
+    iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    if (iterations < 1) {
+        fprintf(stderr, "usage: swtch_bench [iterations]\n");
+        exit(1);
+    }
+
+    printf("%-12s %14s\n", "switch", "ns/round trip");
+    bench_swtch(); // warm up
+    printf("%-12s %14.1f\n", "swtch", bench_swtch());
+    printf("%-12s %14.1f\n", "fiber_yield", bench_fibers());
+    printf("%-12s %14.1f\n", "coroutine", bench_coroutine());
+    printf("%-12s %14.1f\n", "ucontext", bench_ucontext());
+    // a kernel round trip per handoff: fewer rounds keep the run short
+    printf("%-12s %14.1f\n", "condvar", bench_condvar(iterations / 100 > 0 ? iterations / 100 : 1));
+    return 0;
+}
@@ -1,22 +1,208 @@
-// the registers xv6 will save and restore to stop and subsequently restart a process
-
-struct context {
-    /*
-    eip -> instruction pointer -> holds the address of the next instruction to be executed by the CPU
-    when a process is paused (e.g. during a context switch),  the current value of `eip` is saved.
-    when the process resumes, this value is restored, allowing the CPU to continue execution from
-    where it left off.
-     */
-    int eip;
-    /*
-    esp -> stack pointer -> points to the top of the current stack
-    (specifically the value of teh stack pointer in the process's memory). The stack is used for
-    managing function calls, local variables, and returning from fuctions. Saving and restoring the `esp`
-    ensures that the process's stack is maintained correctly when it is switched out and back in.
-     */
-    int esp;
-    /*
-    
-     */
-
-};
\ No newline at end of file
+// xv6's context switch, moved to user space: swtch() between stacks, and a round-robin fiber scheduler on top.
+// struct context, the registers saved and restored to stop and subsequently restart a fiber, is in xv6_kernel.h.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "xv6_kernel.h"
+
+/*
+swtch(old, new) is only called, never jumped into, so the compiler has already saved every caller-saved
+register. it pushes the callee-saved ones below its own return address, records the stack pointer in *old,
+switches to the stack pointer `new` and pops the same set off it. the final `ret` returns into whatever called
+swtch() on that stack -- or, for a new stack, into the entry function context_make() put there.
+ */
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".globl swtch\n"
+    ".type swtch, @function\n"
+    "swtch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"  // *old = the stopped side's context
+    "    movq %rsi, %rsp\n"    // and from here on we are on the other side
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size swtch, .-swtch\n");
+#elif defined(__aarch64__)
+__asm__(
+    ".text\n"
+    ".globl swtch\n"
+    ".type swtch, %function\n"
+    "swtch:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"     // *old = the stopped side's context
+    "    mov sp, x1\n"       // and from here on we are on the other side
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size swtch, .-swtch\n");
+#endif
+
+struct context *context_make(void *stack, void (*entry)(void)) {
+    char *top = (char *) stack + FIBER_STACK_SIZE;
+    struct context *c;
+#if defined(__x86_64__)
+    // entry must start as if called: its return address slot 16-byte aligned, holding a 0 nobody returns to
+    *(uint64_t *) (top - 8) = 0;
+    c = (struct context *) (top - 8 - sizeof(struct context));
+    memset(c, 0, sizeof(*c));
+    __asm__ __volatile__("stmxcsr %0" : "=m"(c->mxcsr));
+    __asm__ __volatile__("fnstcw %0" : "=m"(c->fpucw));
+    c->rip = (uint64_t) entry;
+#elif defined(__aarch64__)
+    c = (struct context *) (top - sizeof(struct context));
+    memset(c, 0, sizeof(*c));
+    c->lr = (uint64_t) entry;
+#endif
+    return c;
+}
+
+// --- stacks --------------------------------------------------------------------------------------------------
+
+static _Thread_local void *free_stacks; // each free stack's lowest word links to the next
+
+void *stack_alloc(void) {
+    if (free_stacks != NULL) {
+        void *stack = free_stacks;
+        free_stacks = *(void **) stack;
+        return stack;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    char *memory = mmap(NULL, page + FIBER_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(memory != MAP_FAILED);
+    int rc = mprotect(memory, page, PROT_NONE); // stacks grow down into the guard page
+    assert(rc == 0);
+    return memory + page;
+}
+
+void stack_free(void *stack) {
+    *(void **) stack = free_stacks;
+    free_stacks = stack;
+}
+
+// --- fibers --------------------------------------------------------------------------------------------------
+
+struct fiber {
+    struct context *context;
+    void (*fn)(void *);
+    void *arg;
+    void *stack;
+    struct fiber *next;
+};
+
+static _Thread_local struct {
+    struct context *context; // fiber_run() while a fiber is running
+    fiber_t *current;
+    fiber_t *head, *tail;    // runnable fibers, oldest first
+    fiber_t *finished;       // exited; fiber_run() frees it once off its stack
+} scheduler;
+
+static void enqueue(fiber_t *f) {
+    f->next = NULL;
+    if (scheduler.tail)
+        scheduler.tail->next = f;
+    else
+        scheduler.head = f;
+    scheduler.tail = f;
+}
+
+static fiber_t *dequeue(void) {
+    fiber_t *f = scheduler.head;
+    if (f) {
+        scheduler.head = f->next;
+        if (scheduler.head == NULL)
+            scheduler.tail = NULL;
+    }
+    return f;
+}
+
+static void fiber_start(void) {
+    fiber_t *self = scheduler.current;
+    self->fn(self->arg);
+    fiber_exit();
+}
+
+fiber_t *fiber_create(void (*fn)(void *), void *arg) {
+    fiber_t *f = malloc(sizeof(fiber_t));
+    assert(f != NULL);
+    f->fn = fn;
+    f->arg = arg;
+    f->stack = stack_alloc();
+    f->context = context_make(f->stack, fiber_start);
+    enqueue(f);
+    return f;
+}
+
+// Switches straight to the next runnable fiber, if there is one, without going through fiber_run()
+void fiber_yield(void) {
+    fiber_t *self = scheduler.current;
+    assert(self != NULL);
+    fiber_t *next = dequeue();
+    if (next == NULL)
+        return;
+    enqueue(self);
+    scheduler.current = next;
+    swtch(&self->context, next->context);
+}
+
+void fiber_exit(void) {
+    fiber_t *self = scheduler.current;
+    assert(self != NULL);
+    scheduler.finished = self;
+    swtch(&self->context, scheduler.context);
+    abort(); // nobody switches back to a finished fiber
+}
+
+// Runs fibers until none is left; fibers may create more as they go
+void fiber_run(void) {
+    assert(scheduler.current == NULL);
+    fiber_t *next;
+    while ((next = dequeue()) != NULL) {
+        scheduler.current = next;
+        swtch(&scheduler.context, next->context);
+        // only an exit comes back here: yields go from fiber to fiber directly
+        scheduler.current = NULL;
+        stack_free(scheduler.finished->stack);
+        free(scheduler.finished);
+        scheduler.finished = NULL;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef __xv6_kernel_h__
+#define __xv6_kernel_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the registers xv6 will save and restore to stop and subsequently restart a process
+// (here: a fiber), laid out in the order swtch() leaves them on the stopped stack
+struct context {
+#if defined(__x86_64__)
+    /*
+    mxcsr and the x87 control word -> SSE and x87 rounding modes and exception masks.
+    the calling convention says a callee must leave them as it found them, so they switch too.
+     */
+    uint32_t mxcsr;
+    uint16_t fpucw;
+    uint16_t pad;
+    /*
+    r15, r14, r13, r12, rbx, rbp -> callee-saved registers. a function may assume they are unchanged
+    across any call it makes, swtch() included, so swtch() saves them for the stopped side and restores
+    the other side's. every other register is caller-saved and already spilled by the compiler.
+     */
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbx;
+    uint64_t rbp;
+    /*
+    rip -> instruction pointer -> holds the address of the next instruction to be executed by the CPU
+    when a process is paused (e.g. during a context switch),  the current value of `rip` is saved.
+    when the process resumes, this value is restored, allowing the CPU to continue execution from
+    where it left off. it is the return address the call to swtch() pushed, so swtch() "restores"
+    it simply by returning.
+     */
+    uint64_t rip;
+#elif defined(__aarch64__)
+    /*
+    x19-x28 -> callee-saved general purpose registers; x29 -> frame pointer;
+    x30 -> link register -> the return address, which plays the role of the instruction pointer;
+    d8-d15 -> the low halves of v8-v15, the callee-saved floating point registers.
+     */
+    uint64_t x[10];
+    uint64_t fp;
+    uint64_t lr;
+    uint64_t d[8];
+#else
+#error "struct context and swtch() are written for x86-64 and AArch64"
+#endif
+    /*
+    rsp / sp -> stack pointer -> points to the top of the current stack. it is not stored in the context:
+    the context sits at the top of the stopped stack, so the pointer to the context *is* the saved stack
+    pointer. swtch() saves it through `old` and loads the other side's from `new`.
+     */
+};
+
+// Builds the context a new FIBER_STACK_SIZE stack starts from.
+// The first swtch() to it calls entry, which must never return.
+struct context *context_make(void *stack, void (*entry)(void));
+
+// Saves the callee-saved registers on the current stack, stores the resulting stack pointer in *old,
+// and resumes whatever stack `new` was saved from. Returns when somebody switches back to *old.
+void swtch(struct context **old, struct context *new_context);
+
+// Guard-paged stacks handed out from a per-thread free list; the lowest page of each faults on overflow
+#define FIBER_STACK_SIZE (64 * 1024)
+
+void *stack_alloc(void);
+void stack_free(void *stack);
+
+// Round-robin fibers on the calling thread
+typedef struct fiber fiber_t;
+
+fiber_t *fiber_create(void (*fn)(void *), void *arg);
+void fiber_yield(void);
+void fiber_exit(void) __attribute__((noreturn));
+void fiber_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __xv6_kernel_h__